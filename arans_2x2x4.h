@@ -12,6 +12,10 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdalign.h>
+#include <pthread.h>
+
+#include "arans_crc.h"
+#include "arans_simd.h"
 
 //constants
 #ifndef RATE_BITS
@@ -22,8 +26,11 @@
 #define PROB_BITS 15                //number of bits for probability
 #define CODE_NORM (1 << CODE_BITS)  //lower bound for normalization
 #define PROB_SIZE (1 << PROB_BITS)  //total for probability factors
+#define RCP_SHIFT (CODE_BITS + PROB_BITS + 8) //x * width of encPut stays below 1 << RCP_SHIFT
 #define CHUNK_SIZE (1 << 13)        //number of bytes per chunk
-#define ALIGN_SHIFT 7               //structure aligning
+#define ARANS_VARIANT 6             //stream variant id, see arans_stream.h
+#define RANGE_LEVELS 3              //number of range arrays per chunk, see encAransModel
+#define WAYS_MAX 8                  //max number of interleaved states per level
 
 #define ALPH1_SIZE (1 << 2)         //number of characters in the alphabet 1
 #define ALPH2_SIZE (1 << 2)         //number of characters in the alphabet 2
@@ -42,9 +49,9 @@
 
 //structs
 struct Arans {
-    uint16_t cdf1[CDF1_SIZE];
-    uint16_t cdf2[ALPH1_SIZE][CDF2_SIZE];
-    uint16_t cdf3[ALPH1_SIZE][ALPH2_SIZE][CDF3_SIZE];
+    uint16_t ALIGN16(cdf1[CDF1_SIZE]);
+    uint16_t ALIGN16(cdf2[ALPH1_SIZE][CDF2_SIZE]);
+    uint16_t ALIGN16(cdf3[ALPH1_SIZE][ALPH2_SIZE][CDF3_SIZE]);
 };
 
 struct Range {
@@ -53,6 +60,8 @@ struct Range {
 };
 
 static uint16_t ALIGN16(updateMtx[ALPH3_SIZE][ALPH3_SIZE]);
+static uint64_t encRcp[PROB_SIZE + 1]; //encRcp[w] = ceil(2^RCP_SHIFT / w), see encPut
+static pthread_once_t encRcpOnce = PTHREAD_ONCE_INIT;
 
 
 // Encoder
@@ -60,17 +69,28 @@ static uint16_t ALIGN16(updateMtx[ALPH3_SIZE][ALPH3_SIZE]);
 //public function declarations
 STORAGE_SPEC void aransInit(struct Arans *);
 
-STORAGE_SPEC size_t aransEncode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
-
 //internal function declarations
-static size_t encChunk(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned char *, size_t, const unsigned char *, size_t);
+static size_t encAransChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static void encAransModel(struct Arans *, struct Range *, const unsigned char *, size_t, uint32_t *);
+
+static size_t encAransRanges(const struct Range *, unsigned char *, size_t, size_t);
 
-static int encPut(uint32_t *, unsigned char **, struct Range);
+static size_t encAransLevel(const struct Range *, unsigned char *, size_t, size_t);
 
-static size_t putOriginalSize(unsigned char *, size_t);
+static void encModel(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], struct Range *, const unsigned char *, size_t, uint32_t *);
+
+static inline void encRcpInit(void);
+
+static void encRcpFill(void);
+
+static int encPut(uint32_t *, unsigned char **, const unsigned char *, struct Range);
 
 static int encFlush(const uint32_t *, unsigned char **, const unsigned char *);
 
+static int encAransSmall(struct Arans *, unsigned char **, const unsigned char *, const unsigned char *, size_t,
+                         uint32_t *);
+
 static inline struct Range modRange(const uint16_t *, unsigned char);
 
 static inline struct Range modSecondRange(const uint16_t (*)[CDF2_SIZE], unsigned char, unsigned char);
@@ -85,6 +105,9 @@ static inline void modThirdUpdate(uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned
 
 //public functions
 STORAGE_SPEC void aransInit(struct Arans *arans) {
+    crcInit();
+    memset(arans, 0, sizeof(struct Arans)); //padding bytes take part in model snapshots
+
     for (int i = 0; i < CDF1_SIZE; ++i)
         arans->cdf1[i] = i << (PROB_BITS - 8);
 
@@ -102,60 +125,85 @@ STORAGE_SPEC void aransInit(struct Arans *arans) {
             updateMtx[i][j] = ((j + 1) + ((i < (j + 1)) ? PROB_SIZE - 1 : 0));
 }
 
-STORAGE_SPEC size_t
-aransEncode(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
-    size_t offset = putOriginalSize(out, in_size);
-    unsigned char *out_cur = &out[offset];
-    const unsigned char *in_cur = in;
-    size_t out_rem = out_size - offset;
-    size_t in_rem = in_size;
-    size_t ret;
+//internal functions
+static size_t
+encAransChunk(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc) {
+    struct Range range[RANGE_LEVELS * CHUNK_SIZE];
 
-    uint16_t ALIGN16(cdf_align1[CDF1_SIZE + ALIGN_SHIFT]);
-    uint16_t ALIGN16(cdf_align2[ALPH1_SIZE + ALIGN_SHIFT][CDF2_SIZE]);
-    uint16_t ALIGN16(cdf_align3[ALPH1_SIZE + ALIGN_SHIFT][ALPH2_SIZE][CDF3_SIZE]);
+    encAransModel(arans, range, in, in_size, crc);
+    return encAransRanges(range, out, out_size, in_size);
+}
 
-    uint16_t *cdf1 = &cdf_align1[ALIGN_SHIFT];
-    uint16_t (*cdf2)[CDF2_SIZE] = &cdf_align2[ALIGN_SHIFT];
-    uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE] = &cdf_align3[ALIGN_SHIFT];
+//model pass of encAransChunk, range receives RANGE_LEVELS arrays of CHUNK_SIZE ranges
+static void
+encAransModel(struct Arans *arans, struct Range *range, const unsigned char *in, size_t in_size, uint32_t *crc) {
+    encModel(arans->cdf1, arans->cdf2, arans->cdf3, range, in, in_size, crc);
+}
 
-    memcpy(cdf1, arans->cdf1, sizeof(arans->cdf1));
-    memcpy(cdf2, arans->cdf2, sizeof(arans->cdf2));
-    memcpy(cdf3, arans->cdf3, sizeof(arans->cdf3));
+//backward pass of encAransChunk, runs on any thread once the model pass has filled range
+static size_t encAransRanges(const struct Range *range, unsigned char *out, size_t out_size, size_t in_size) {
+    encRcpInit();
 
-    while (in_rem > CHUNK_SIZE) {
-        if (!(ret = encChunk(cdf1, cdf2, cdf3, out_cur, out_rem, in_cur, CHUNK_SIZE)))
+    unsigned char *ptr = &out[out_size];
+    const struct Range *range1 = range;
+    const struct Range *range2 = &range[CHUNK_SIZE];
+    const struct Range *range3 = &range[2 * CHUNK_SIZE];
+    uint32_t cod1 = CODE_NORM;
+    uint32_t cod2 = CODE_NORM;
+    uint32_t cod3 = CODE_NORM;
+
+    for (size_t i = in_size; i > 0; --i) {
+        if (encPut(&cod3, &ptr, out, range3[i - 1]))
             return 0;
 
-        out_cur = &out_cur[ret];
-        out_rem -= ret;
-        in_cur = &in_cur[CHUNK_SIZE];
-        in_rem -= CHUNK_SIZE;
+        if (encPut(&cod2, &ptr, out, range2[i - 1]))
+            return 0;
+
+        if (encPut(&cod1, &ptr, out, range1[i - 1]))
+            return 0;
     }
 
-    if (!(ret = encChunk(cdf1, cdf2, cdf3, out_cur, out_rem, in_cur, in_rem)))
+    if (encFlush(&cod3, &ptr, out))
+        return 0;
+
+    if (encFlush(&cod2, &ptr, out))
+        return 0;
+
+    if (encFlush(&cod1, &ptr, out))
         return 0;
 
-    out_rem -= ret;
-    memcpy(arans->cdf1, cdf1, sizeof(arans->cdf1));
-    memcpy(arans->cdf2, cdf2, sizeof(arans->cdf2));
-    memcpy(arans->cdf3, cdf3, sizeof(arans->cdf3));
-    return out_size - out_rem;
+    size_t size = &out[out_size] - ptr;
+    memmove(out, ptr, size);
+    return size;
 }
 
-//internal functions
-static size_t
-encChunk(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE], unsigned char *out, size_t out_size, const unsigned char *in,
-         size_t in_size) {
+//backward pass of one level into its own substream, see CHUNK_LEVELS in arans_stream.h
+static size_t encAransLevel(const struct Range *range, unsigned char *out, size_t out_size, size_t in_size) {
+    encRcpInit();
+
     unsigned char *ptr = &out[out_size];
+    uint32_t cod = CODE_NORM;
 
-    struct Range range1[CHUNK_SIZE];
-    struct Range range2[CHUNK_SIZE];
-    struct Range range3[CHUNK_SIZE];
+    for (size_t i = in_size; i > 0; --i)
+        if (encPut(&cod, &ptr, out, range[i - 1]))
+            return 0;
 
-    uint32_t cod1 = CODE_NORM;
-    uint32_t cod2 = CODE_NORM;
-    uint32_t cod3 = CODE_NORM;
+    if (encFlush(&cod, &ptr, out))
+        return 0;
+
+    size_t size = &out[out_size] - ptr;
+    memmove(out, ptr, size);
+    return size;
+}
+
+static void
+encModel(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE], struct Range *range,
+         const unsigned char *in, size_t in_size, uint32_t *crc) {
+    struct Range *range1 = range;
+    struct Range *range2 = &range[CHUNK_SIZE];
+    struct Range *range3 = &range[2 * CHUNK_SIZE];
+    uint32_t sum = crc ? *crc : 0;
 
     for (size_t i = 0; i < in_size; ++i) {
         unsigned char n1 = in[i] >> 6;
@@ -169,59 +217,91 @@ encChunk(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZ
         modUpdate(cdf1, n1);
         modSecondUpdate(cdf2, n1, n2);
         modThirdUpdate(cdf3, n1, n2, n3);
+
+        if (crc)
+            sum = crcByte(sum, in[i]);
     }
 
-    for (size_t i = in_size; i > 0; --i) {
-        if (encPut(&cod3, &ptr, range3[i - 1]))
-            return 0;
+    if (crc)
+        *crc = sum;
+}
 
-        if (encPut(&cod2, &ptr, range2[i - 1]))
-            return 0;
+//codes in with one state shared by all levels and without a flush, the bytes are written down
+//from *pptr to lim, state holds the initial state and receives the final one, see aransEncodeSmall
+static int encAransSmall(struct Arans *arans, unsigned char **pptr, const unsigned char *lim, const unsigned char *in,
+                         size_t in_size, uint32_t *state) {
+    encRcpInit();
 
-        if (encPut(&cod1, &ptr, range1[i - 1]))
-            return 0;
+    struct Range range1[CHUNK_SIZE];
+    struct Range range2[CHUNK_SIZE];
+    struct Range range3[CHUNK_SIZE];
+
+    if (in_size > CHUNK_SIZE)
+        return 1;
+
+    for (size_t i = 0; i < in_size; ++i) {
+        unsigned char n1 = in[i] >> 6;
+        unsigned char n2 = (in[i] & 0x30) >> 4;
+        unsigned char n3 = in[i] & 0xF;
+
+        range1[i] = modRange(arans->cdf1, n1);
+        range2[i] = modSecondRange(arans->cdf2, n1, n2);
+        range3[i] = modThirdRange(arans->cdf3, n1, n2, n3);
+
+        modUpdate(arans->cdf1, n1);
+        modSecondUpdate(arans->cdf2, n1, n2);
+        modThirdUpdate(arans->cdf3, n1, n2, n3);
     }
 
-    if (encFlush(&cod3, &ptr, out))
-        return 0;
+    //the last level goes first, so the decoder meets the levels in order
+    for (size_t i = in_size; i > 0; --i) {
+        if (encPut(state, pptr, lim, range3[i - 1]))
+            return 1;
 
-    if (encFlush(&cod2, &ptr, out))
-        return 0;
+        if (encPut(state, pptr, lim, range2[i - 1]))
+            return 1;
 
-    if (encFlush(&cod1, &ptr, out))
-        return 0;
+        if (encPut(state, pptr, lim, range1[i - 1]))
+            return 1;
+    }
 
-    size_t size = &out[out_size] - ptr;
-    memmove(out, ptr, size);
-    return size;
+    return 0;
+}
+
+//fills encRcp once per process, every coder that calls encPut runs it first, so the table does not depend on
+//how the model was built and threads starting to code at once all wait for the one fill
+static inline void encRcpInit(void) {
+    pthread_once(&encRcpOnce, encRcpFill);
+}
+
+static void encRcpFill(void) {
+    for (uint64_t w = 1; w <= PROB_SIZE; ++w)
+        encRcp[w] = ((1ull << RCP_SHIFT) + w - 1) / w;
 }
 
-static int encPut(uint32_t *c, unsigned char **pptr, struct Range range) {
+static int encPut(uint32_t *c, unsigned char **pptr, const unsigned char *lim, struct Range range) {
     uint32_t x = *c;
     uint32_t x_max = range.width << (CODE_BITS - PROB_BITS + 8);
 
     if (x >= x_max) {
         unsigned char *ptr = *pptr;
         do {
+            if (ptr <= lim)
+                return 1;
+
             *--ptr = x;
             x >>= 8;
         } while (x >= x_max);
         *pptr = ptr;
     }
 
-    *c = x + (PROB_SIZE - range.width) * (x / range.width) + range.start;
+    //x < width << (CODE_BITS - PROB_BITS + 8) and width <= PROB_SIZE, so x * width < 1 << RCP_SHIFT and the
+    //reciprocal gives x / width exactly, the product stays below 1 << 64 while CODE_BITS + 8 <= 32
+    uint32_t q = (uint32_t) (((uint64_t) x * encRcp[range.width]) >> RCP_SHIFT);
+    *c = x + (PROB_SIZE - range.width) * q + range.start;
     return 0;
 }
 
-static size_t putOriginalSize(unsigned char *out, size_t in_size) {
-    *out++ = in_size >> 24;
-    *out++ = in_size >> 16;
-    *out++ = in_size >> 8;
-    *out++ = in_size;
-
-    return 4;
-}
-
 static int encFlush(const uint32_t *c, unsigned char **pptr, const unsigned char *lim) {
     if (*pptr < &lim[4])
         return 1;
@@ -247,18 +327,15 @@ static inline struct Range modThirdRange(const uint16_t (*cdf)[ALPH2_SIZE][CDF3_
 }
 
 static inline void modUpdate(uint16_t *cdf, unsigned char c) {
-    for (int i = 1; i < CDF1_SIZE; ++i)
-        cdf[i] = ((cdf[i] << RATE_BITS) + updateMtx[c][i - 1] - cdf[i]) >> RATE_BITS;
+    simdUpdate(&cdf[1], updateMtx[c], ALPH1_SIZE, RATE_BITS);
 }
 
 static inline void modSecondUpdate(uint16_t (*cdf)[CDF2_SIZE], unsigned char n1, unsigned char n2) {
-    for (int i = 1; i < CDF2_SIZE; ++i)
-        cdf[n1][i] = ((cdf[n1][i] << RATE_BITS) + updateMtx[n2][i - 1] - cdf[n1][i]) >> RATE_BITS;
+    simdUpdate(&cdf[n1][1], updateMtx[n2], ALPH2_SIZE, RATE_BITS);
 }
 
 static inline void modThirdUpdate(uint16_t (*cdf)[ALPH2_SIZE][CDF3_SIZE], unsigned char n1, unsigned char n2, unsigned char n3) {
-    for (int i = 1; i < CDF3_SIZE; ++i)
-        cdf[n1][n2][i] = ((cdf[n1][n2][i] << RATE_BITS) + updateMtx[n3][i - 1] - cdf[n1][n2][i]) >> RATE_BITS;
+    simdUpdate(&cdf[n1][n2][1], updateMtx[n3], ALPH3_SIZE, RATE_BITS);
 }
 
 // Encoder
@@ -266,18 +343,36 @@ static inline void modThirdUpdate(uint16_t (*cdf)[ALPH2_SIZE][CDF3_SIZE], unsign
 
 // Decoder
 
-// public function declarations
-STORAGE_SPEC size_t aransDecode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+// internal function declarations
+static size_t decAransChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static size_t
+decAransWays(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *, unsigned);
 
-STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *);
+static inline int decAransStep(struct Arans *, unsigned char *, uint32_t *, unsigned char **);
 
-// internal function declarations
-static size_t decChunk(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned char *, size_t, const unsigned char *, size_t);
+static int decAransLevels(struct Arans *, unsigned char *, size_t, const unsigned char *, const size_t *, uint32_t *);
+
+static int decAransLevel(struct Arans *, unsigned, unsigned char *, size_t, size_t, uint32_t *, unsigned char **,
+                         const unsigned char *);
+
+static size_t decChunk(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static size_t decWays(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned char *,
+                      size_t, const unsigned char *, size_t, uint32_t *, unsigned);
+
+static int decLevels(uint16_t *, uint16_t (*)[CDF2_SIZE], uint16_t (*)[ALPH2_SIZE][CDF3_SIZE], unsigned char *,
+                     size_t, const unsigned char *, const size_t *, uint32_t *);
 
 static int decInit(uint32_t *, unsigned char **, const unsigned char *);
 
 static int decPut(uint32_t *, unsigned char **, struct Range);
 
+static int decAransSmall(struct Arans *, unsigned char *, size_t, const unsigned char **, const unsigned char *,
+                         uint32_t *);
+
+static int decSmallPut(uint32_t *, const unsigned char **, const unsigned char *, struct Range);
+
 static inline uint16_t decGet(const uint32_t *);
 
 static unsigned char modSymb(const uint16_t *, uint16_t);
@@ -286,65 +381,56 @@ static unsigned char modSecondSymb(const uint16_t (*)[CDF2_SIZE], unsigned char,
 
 static unsigned char modThirdSymb(const uint16_t (*cdf)[ALPH2_SIZE][CDF3_SIZE], unsigned char, unsigned char, uint16_t);
 
-// public functions
-STORAGE_SPEC size_t aransDecode(struct Arans *arans, unsigned char *out, const size_t out_size, const unsigned char *in,
-                                const size_t in_size) {
-    size_t offset = 4;
-    unsigned char *out_cur = out;
-    const unsigned char *in_cur = &in[offset];
-    size_t out_rem = out_size;
-    size_t in_rem = in_size - offset;
-    size_t ret;
-
-    uint16_t ALIGN16(cdf_align1[CDF1_SIZE + ALIGN_SHIFT]);
-    uint16_t ALIGN16(cdf_align2[ALPH1_SIZE + ALIGN_SHIFT][CDF2_SIZE]);
-    uint16_t ALIGN16(cdf_align3[ALPH1_SIZE + ALIGN_SHIFT][ALPH2_SIZE][CDF3_SIZE]);
-
-    uint16_t *cdf1 = &cdf_align1[ALIGN_SHIFT];
-    uint16_t (*cdf2)[CDF2_SIZE] = &cdf_align2[ALIGN_SHIFT];
-    uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE] = &cdf_align3[ALIGN_SHIFT];
-
-    memcpy(cdf1, arans->cdf1, sizeof(arans->cdf1));
-    memcpy(cdf2, arans->cdf2, sizeof(arans->cdf2));
-    memcpy(cdf3, arans->cdf3, sizeof(arans->cdf3));
-
-    while (out_rem > CHUNK_SIZE) {
-        if (!(ret = decChunk(cdf1, cdf2, cdf3, out_cur, CHUNK_SIZE, in_cur, in_rem)))
-            return 0;
+// internal functions
+static size_t
+decAransChunk(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc) {
+    return decChunk(arans->cdf1, arans->cdf2, arans->cdf3, out, out_size, in, in_size, crc);
+}
 
-        in_cur = &in_cur[ret];
-        in_rem -= ret;
-        out_cur = &out_cur[CHUNK_SIZE];
-        out_rem -= CHUNK_SIZE;
-    }
+static size_t
+decAransWays(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+             uint32_t *crc, unsigned ways) {
+    return decWays(arans->cdf1, arans->cdf2, arans->cdf3, out, out_size, in, in_size, crc, ways);
+}
 
-    if (!(ret = decChunk(cdf1, cdf2, cdf3, out_cur, out_rem, in_cur, in_rem)))
-        return 0;
+//decodes one symbol of a plain chunk into out, cod holds a state per level,
+//the steps of two chunks may be interleaved, see decPairChunks in arans_stream.h
+static inline int decAransStep(struct Arans *arans, unsigned char *out, uint32_t *cod, unsigned char **pptr) {
+    unsigned char n1 = modSymb(arans->cdf1, decGet(&cod[0]));
+    unsigned char n2 = modSecondSymb(arans->cdf2, n1, decGet(&cod[1]));
+    unsigned char n3 = modThirdSymb(arans->cdf3, n1, n2, decGet(&cod[2]));
 
-    in_rem -= ret;
-    memcpy(arans->cdf1, cdf1, sizeof(arans->cdf1));
-    memcpy(arans->cdf2, cdf2, sizeof(arans->cdf2));
-    memcpy(arans->cdf3, cdf3, sizeof(arans->cdf3));
-    return in_size - in_rem - offset;
-}
+    struct Range range1 = modRange(arans->cdf1, n1);
+    struct Range range2 = modSecondRange(arans->cdf2, n1, n2);
+    struct Range range3 = modThirdRange(arans->cdf3, n1, n2, n3);
 
-STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *in) {
-    size_t size = *in++ << 24;
-    size |= *in++ << 16;
-    size |= *in++ << 8;
-    size |= *in;
+    modUpdate(arans->cdf1, n1);
+    modSecondUpdate(arans->cdf2, n1, n2);
+    modThirdUpdate(arans->cdf3, n1, n2, n3);
 
-    return size;
+    if (decPut(&cod[0], pptr, range1))
+        return 1;
+
+    if (decPut(&cod[1], pptr, range2))
+        return 1;
+
+    if (decPut(&cod[2], pptr, range3))
+        return 1;
+
+    *out = (n1 << 6) | (n2 << 4) | n3;
+
+    return 0;
 }
 
-// internal functions
 static size_t decChunk(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE], unsigned char *out, const size_t out_size,
                        const unsigned char *in,
-                       const size_t in_size) {
+                       const size_t in_size, uint32_t *crc) {
     unsigned char *ptr = (unsigned char *) in;
     uint32_t cod1;
     uint32_t cod2;
     uint32_t cod3;
+    uint32_t sum = crc ? *crc : 0;
 
     if (decInit(&cod1, &ptr, &in[in_size]))
         return 0;
@@ -378,14 +464,237 @@ static size_t decChunk(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*c
             return 0;
 
         out[i] = (n1 << 6) | (n2 << 4) | n3;
+
+        if (crc)
+            sum = crcByte(sum, out[i]);
     }
 
+    if (crc)
+        *crc = sum;
+
     if ((cod1 != CODE_NORM) || (cod2 != CODE_NORM) || (cod3 != CODE_NORM))
         return 0;
 
     return ptr - in;
 }
 
+//decChunk with ways interleaved states per level, symbol i is decoded by state i % ways,
+//see CHUNK_WAYS in arans_stream.h
+static size_t
+decWays(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE], unsigned char *out,
+        const size_t out_size, const unsigned char *in, const size_t in_size, uint32_t *crc, unsigned ways) {
+    unsigned char *ptr = (unsigned char *) in;
+    uint32_t cod1[WAYS_MAX];
+    uint32_t cod2[WAYS_MAX];
+    uint32_t cod3[WAYS_MAX];
+    uint32_t sum = crc ? *crc : 0;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if (decInit(&cod1[w], &ptr, &in[in_size]))
+            return 0;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if (decInit(&cod2[w], &ptr, &in[in_size]))
+            return 0;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if (decInit(&cod3[w], &ptr, &in[in_size]))
+            return 0;
+
+    for (size_t i = 0; i < out_size; ++i) {
+        unsigned w = i & (ways - 1);
+        unsigned char n1 = modSymb(cdf1, decGet(&cod1[w]));
+        unsigned char n2 = modSecondSymb(cdf2, n1, decGet(&cod2[w]));
+        unsigned char n3 = modThirdSymb(cdf3, n1, n2, decGet(&cod3[w]));
+
+        struct Range range1 = modRange(cdf1, n1);
+        struct Range range2 = modSecondRange(cdf2, n1, n2);
+        struct Range range3 = modThirdRange(cdf3, n1, n2, n3);
+
+        modUpdate(cdf1, n1);
+        modSecondUpdate(cdf2, n1, n2);
+        modThirdUpdate(cdf3, n1, n2, n3);
+
+        if (decPut(&cod1[w], &ptr, range1))
+            return 0;
+
+        if (decPut(&cod2[w], &ptr, range2))
+            return 0;
+
+        if (decPut(&cod3[w], &ptr, range3))
+            return 0;
+
+        out[i] = (n1 << 6) | (n2 << 4) | n3;
+
+        if (crc)
+            sum = crcByte(sum, out[i]);
+    }
+
+    if (crc)
+        *crc = sum;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if ((cod1[w] != CODE_NORM) || (cod2[w] != CODE_NORM) || (cod3[w] != CODE_NORM))
+            return 0;
+
+    return ptr - in;
+}
+
+//decodes a CHUNK_LEVELS chunk, the substreams of the levels follow each other from in, sizes holds their sizes
+static int
+decAransLevels(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in,
+               const size_t *sizes, uint32_t *crc) {
+    return decLevels(arans->cdf1, arans->cdf2, arans->cdf3, out, out_size, in, sizes, crc);
+}
+
+//decodes the symbols first to first + count - 1 of one level of a CHUNK_LEVELS chunk into out,
+//the levels above have put their bits there already, the state of the level is read from its substream
+//at *pptr up to lim when first is 0, so every level can run on a thread of its own behind the one above
+static int
+decAransLevel(struct Arans *arans, unsigned level, unsigned char *out, size_t first, size_t count, uint32_t *cod,
+              unsigned char **pptr, const unsigned char *lim) {
+    if (!first && decInit(cod, pptr, lim))
+        return 1;
+
+    if (level == 0) {
+        for (size_t i = first; i < first + count; ++i) {
+            unsigned char n1 = modSymb(arans->cdf1, decGet(cod));
+            struct Range range = modRange(arans->cdf1, n1);
+            modUpdate(arans->cdf1, n1);
+
+            if (decPut(cod, pptr, range))
+                return 1;
+
+            out[i] = n1 << 6;
+        }
+
+        return 0;
+    }
+
+    if (level == 1) {
+        for (size_t i = first; i < first + count; ++i) {
+            unsigned char n1 = out[i] >> 6;
+            unsigned char n2 = modSecondSymb(arans->cdf2, n1, decGet(cod));
+            struct Range range = modSecondRange(arans->cdf2, n1, n2);
+            modSecondUpdate(arans->cdf2, n1, n2);
+
+            if (decPut(cod, pptr, range))
+                return 1;
+
+            out[i] |= n2 << 4;
+        }
+
+        return 0;
+    }
+
+    for (size_t i = first; i < first + count; ++i) {
+        unsigned char n1 = out[i] >> 6;
+        unsigned char n2 = (out[i] >> 4) & 3;
+        unsigned char n3 = modThirdSymb(arans->cdf3, n1, n2, decGet(cod));
+        struct Range range = modThirdRange(arans->cdf3, n1, n2, n3);
+        modThirdUpdate(arans->cdf3, n1, n2, n3);
+
+        if (decPut(cod, pptr, range))
+            return 1;
+
+        out[i] |= n3;
+    }
+
+    return 0;
+}
+
+static int
+decLevels(uint16_t *cdf1, uint16_t (*cdf2)[CDF2_SIZE], uint16_t (*cdf3)[ALPH2_SIZE][CDF3_SIZE], unsigned char *out,
+          size_t out_size, const unsigned char *in, const size_t *sizes, uint32_t *crc) {
+    const unsigned char *end1 = &in[sizes[0]];
+    const unsigned char *end2 = &end1[sizes[1]];
+    const unsigned char *end3 = &end2[sizes[2]];
+    unsigned char *ptr1 = (unsigned char *) in;
+    unsigned char *ptr2 = (unsigned char *) end1;
+    unsigned char *ptr3 = (unsigned char *) end2;
+    uint32_t cod1;
+    uint32_t cod2;
+    uint32_t cod3;
+    uint32_t sum = crc ? *crc : 0;
+
+    if (decInit(&cod1, &ptr1, end1))
+        return 1;
+
+    if (decInit(&cod2, &ptr2, end2))
+        return 1;
+
+    if (decInit(&cod3, &ptr3, end3))
+        return 1;
+
+    for (size_t i = 0; i < out_size; ++i) {
+        unsigned char n1 = modSymb(cdf1, decGet(&cod1));
+        unsigned char n2 = modSecondSymb(cdf2, n1, decGet(&cod2));
+        unsigned char n3 = modThirdSymb(cdf3, n1, n2, decGet(&cod3));
+
+        struct Range range1 = modRange(cdf1, n1);
+        struct Range range2 = modSecondRange(cdf2, n1, n2);
+        struct Range range3 = modThirdRange(cdf3, n1, n2, n3);
+
+        modUpdate(cdf1, n1);
+        modSecondUpdate(cdf2, n1, n2);
+        modThirdUpdate(cdf3, n1, n2, n3);
+
+        if (decPut(&cod1, &ptr1, range1))
+            return 1;
+
+        if (decPut(&cod2, &ptr2, range2))
+            return 1;
+
+        if (decPut(&cod3, &ptr3, range3))
+            return 1;
+
+        out[i] = (n1 << 6) | (n2 << 4) | n3;
+
+        if (crc)
+            sum = crcByte(sum, out[i]);
+    }
+
+    if (crc)
+        *crc = sum;
+
+    //every level ends where its substream does
+    return (cod1 != CODE_NORM) || (cod2 != CODE_NORM) || (cod3 != CODE_NORM) ||
+           (ptr1 != end1) || (ptr2 != end2) || (ptr3 != end3);
+}
+
+//decodes out_size bytes coded by encAransSmall from *pptr, reading no further than lim,
+//state holds the final state of the encoder and receives the initial one
+static int decAransSmall(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char **pptr,
+                         const unsigned char *lim, uint32_t *state) {
+    for (size_t i = 0; i < out_size; ++i) {
+        unsigned char n1 = modSymb(arans->cdf1, decGet(state));
+        struct Range range1 = modRange(arans->cdf1, n1);
+
+        if (decSmallPut(state, pptr, lim, range1))
+            return 1;
+
+        unsigned char n2 = modSecondSymb(arans->cdf2, n1, decGet(state));
+        struct Range range2 = modSecondRange(arans->cdf2, n1, n2);
+
+        if (decSmallPut(state, pptr, lim, range2))
+            return 1;
+
+        unsigned char n3 = modThirdSymb(arans->cdf3, n1, n2, decGet(state));
+        struct Range range3 = modThirdRange(arans->cdf3, n1, n2, n3);
+
+        if (decSmallPut(state, pptr, lim, range3))
+            return 1;
+
+        modUpdate(arans->cdf1, n1);
+        modSecondUpdate(arans->cdf2, n1, n2);
+        modThirdUpdate(arans->cdf3, n1, n2, n3);
+
+        out[i] = (n1 << 6) | (n2 << 4) | n3;
+    }
+
+    return 0;
+}
+
 static int decInit(uint32_t *c, unsigned char **pptr, const unsigned char *lim) {
     if (*pptr > &lim[-4])
         return 1;
@@ -414,28 +723,38 @@ static int decPut(uint32_t *c, unsigned char **pptr, const struct Range range) {
     return 0;
 }
 
+//decPut that stops reading at lim, the state of a small message starts below CODE_NORM
+static int decSmallPut(uint32_t *c, const unsigned char **pptr, const unsigned char *lim, const struct Range range) {
+    uint32_t x = *c;
+    const unsigned char *ptr = *pptr;
+    x = range.width * (x >> PROB_BITS) + (x & (PROB_SIZE - 1)) - range.start;
+
+    while ((x < CODE_NORM) && (ptr < lim))
+        x = (x << 8) | *ptr++;
+
+    *pptr = ptr;
+    *c = x;
+    return 0;
+}
+
 static inline uint16_t decGet(const uint32_t *c) {
     return *c & (PROB_SIZE - 1);
 }
 
 static unsigned char modSymb(const uint16_t *cdf, const uint16_t prb) {
-    for (int i = 1; i < CDF1_SIZE; ++i)
-        if (prb < cdf[i])
-            return i - 1;
+    return simdCount(cdf, prb, ALPH1_SIZE) - 1;
 }
 
 static unsigned char modSecondSymb(const uint16_t (*cdf)[CDF2_SIZE], unsigned char n1, const uint16_t prb) {
-    for (int i = 1; i < CDF2_SIZE; ++i)
-        if (prb < cdf[n1][i])
-            return i - 1;
+    return simdCount(cdf[n1], prb, ALPH2_SIZE) - 1;
 }
 
 static unsigned char modThirdSymb(const uint16_t (*cdf)[ALPH2_SIZE][CDF3_SIZE], unsigned char n1, unsigned char n2, const uint16_t prb) {
-    for (int i = 1; i < CDF3_SIZE; ++i)
-        if (prb < cdf[n1][n2][i])
-            return i - 1;
+    return simdCount(cdf[n1][n2], prb, ALPH3_SIZE) - 1;
 }
 
 // Decoder
 
+#include "arans_stream.h"
+
 #endif //ARANS_ARANS_2x2x4_H
\ No newline at end of file
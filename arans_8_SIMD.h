@@ -12,8 +12,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdalign.h>
+#include <pthread.h>
 #include <immintrin.h>
 
+#include "arans_crc.h"
+
 //constants
 #ifndef RATE_BITS
 #define RATE_BITS 8                 //number of rate bits for adaption shift
@@ -23,10 +26,14 @@
 #define PROB_BITS 15                //number of bits for probability
 #define CODE_NORM (1 << CODE_BITS)  //lower bound for normalization
 #define PROB_SIZE (1 << PROB_BITS)  //total for probability factors
+#define RCP_SHIFT (CODE_BITS + PROB_BITS + 8) //x * width of encPut stays below 1 << RCP_SHIFT
 #define CHUNK_SIZE (1 << 13)        //number of bytes per chunk
+#define ARANS_VARIANT 1             //stream variant id, see arans_stream.h
+#define RANGE_LEVELS 1              //number of range arrays per chunk, see encAransModel
+#define WAYS_MAX 8                  //max number of interleaved states per level
 #define ALPH_SIZE (1 << 8)          //number of characters in the alphabet
 #define CDF_SIZE (ALPH_SIZE + 1)    //number of elements in cdf
-#define ALIGN_SHIFT 7               //structure aligning
+#define ALIGN_SHIFT 15              //padding that puts cdf[1] on a vector boundary
 
 //implementation section
 #ifdef __cplusplus
@@ -38,6 +45,7 @@
 
 //structs
 struct Arans {
+    uint16_t ALIGN_ALPH_SIZE(pad[ALIGN_SHIFT]);
     uint16_t cdf[CDF_SIZE];
 };
 
@@ -47,6 +55,8 @@ struct Range {
 };
 
 static uint16_t ALIGN_ALPH_SIZE(updateMtx[ALPH_SIZE][ALPH_SIZE]);
+static uint64_t encRcp[PROB_SIZE + 1]; //encRcp[w] = ceil(2^RCP_SHIFT / w), see encPut
+static pthread_once_t encRcpOnce = PTHREAD_ONCE_INIT;
 
 
 // Encoder
@@ -54,23 +64,37 @@ static uint16_t ALIGN_ALPH_SIZE(updateMtx[ALPH_SIZE][ALPH_SIZE]);
 //public function declarations
 STORAGE_SPEC void aransInit(struct Arans *);
 
-STORAGE_SPEC size_t aransEncode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
-
 //internal function declarations
-static size_t encChunk(uint16_t *, unsigned char *, size_t, const unsigned char *, size_t);
+static size_t encAransChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static void encAransModel(struct Arans *, struct Range *, const unsigned char *, size_t, uint32_t *);
+
+static size_t encAransRanges(const struct Range *, unsigned char *, size_t, size_t);
+
+static size_t encAransLevel(const struct Range *, unsigned char *, size_t, size_t);
 
-static int encPut(uint32_t *, unsigned char **, struct Range);
+static void encModel(uint16_t *, struct Range *, const unsigned char *, size_t, uint32_t *);
 
-static size_t putOriginalSize(unsigned char *, size_t);
+static inline void encRcpInit(void);
+
+static void encRcpFill(void);
+
+static int encPut(uint32_t *, unsigned char **, const unsigned char *, struct Range);
 
 static int encFlush(const uint32_t *, unsigned char **, const unsigned char *);
 
+static int encAransSmall(struct Arans *, unsigned char **, const unsigned char *, const unsigned char *, size_t,
+                         uint32_t *);
+
 static inline struct Range modRange(const uint16_t *, unsigned char);
 
 static inline void modUpdate(uint16_t *, unsigned char);
 
 //public functions
 STORAGE_SPEC void aransInit(struct Arans *arans) {
+    crcInit();
+    memset(arans, 0, sizeof(struct Arans)); //padding bytes take part in model snapshots
+
     for (int i = 0; i < CDF_SIZE; ++i)
         arans->cdf[i] = i << (PROB_BITS - 8);
 
@@ -79,51 +103,31 @@ STORAGE_SPEC void aransInit(struct Arans *arans) {
             updateMtx[i][j] = ((j + 1) + ((i < (j + 1)) ? PROB_SIZE - 1 : 0));
 }
 
-STORAGE_SPEC size_t
-aransEncode(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
-    size_t offset = putOriginalSize(out, in_size);
-    unsigned char *out_cur = &out[offset];
-    const unsigned char *in_cur = in;
-    size_t out_rem = out_size - offset;
-    size_t in_rem = in_size;
-    size_t ret;
-
-    uint16_t ALIGN_ALPH_SIZE(cdf_align[CDF_SIZE + ALIGN_SHIFT]);
-    uint16_t *cdf = &cdf_align[ALIGN_SHIFT];
-    memcpy(cdf, arans->cdf, sizeof(arans->cdf));
-
-    while (in_rem > CHUNK_SIZE) {
-        if (!(ret = encChunk(cdf, out_cur, out_rem, in_cur, CHUNK_SIZE)))
-            return 0;
-
-        out_cur = &out_cur[ret];
-        out_rem -= ret;
-        in_cur = &in_cur[CHUNK_SIZE];
-        in_rem -= CHUNK_SIZE;
-    }
+//internal functions
+static size_t
+encAransChunk(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc) {
+    struct Range range[RANGE_LEVELS * CHUNK_SIZE];
 
-    if (!(ret = encChunk(cdf, out_cur, out_rem, in_cur, in_rem)))
-        return 0;
+    encAransModel(arans, range, in, in_size, crc);
+    return encAransRanges(range, out, out_size, in_size);
+}
 
-    out_rem -= ret;
-    memcpy(arans->cdf, cdf, sizeof(arans->cdf));
-    return out_size - out_rem;
+//model pass of encAransChunk, range receives RANGE_LEVELS arrays of CHUNK_SIZE ranges
+static void
+encAransModel(struct Arans *arans, struct Range *range, const unsigned char *in, size_t in_size, uint32_t *crc) {
+    encModel(arans->cdf, range, in, in_size, crc);
 }
 
-//internal functions
-static size_t encChunk(uint16_t *cdf, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
+//backward pass of encAransChunk, runs on any thread once the model pass has filled range
+static size_t encAransRanges(const struct Range *range, unsigned char *out, size_t out_size, size_t in_size) {
+    encRcpInit();
+
     unsigned char *ptr = &out[out_size];
-    struct Range range[CHUNK_SIZE];
     uint32_t cod = CODE_NORM;
 
-    for (size_t i = 0; i < in_size; ++i) {
-        unsigned char n = in[i];
-        range[i] = modRange(cdf, n);
-        modUpdate(cdf, n);
-    }
-
     for (size_t i = in_size; i > 0; --i)
-        if (encPut(&cod, &ptr, range[i - 1]))
+        if (encPut(&cod, &ptr, out, range[i - 1]))
             return 0;
 
     if (encFlush(&cod, &ptr, out))
@@ -134,32 +138,89 @@ static size_t encChunk(uint16_t *cdf, unsigned char *out, size_t out_size, const
     return size;
 }
 
-static int encPut(uint32_t *c, unsigned char **pptr, struct Range range) {
+//backward pass of one level into its own substream, see CHUNK_LEVELS in arans_stream.h,
+//the only level of this variant is the whole chunk
+static size_t encAransLevel(const struct Range *range, unsigned char *out, size_t out_size, size_t in_size) {
+    encRcpInit();
+
+    return encAransRanges(range, out, out_size, in_size);
+}
+
+static void
+encModel(uint16_t *cdf, struct Range *range, const unsigned char *in, size_t in_size, uint32_t *crc) {
+    uint32_t sum = crc ? *crc : 0;
+
+    for (size_t i = 0; i < in_size; ++i) {
+        unsigned char n = in[i];
+        range[i] = modRange(cdf, n);
+        modUpdate(cdf, n);
+
+        if (crc)
+            sum = crcByte(sum, in[i]);
+    }
+
+    if (crc)
+        *crc = sum;
+}
+
+//codes in with the state passed in and without a flush, the bytes are written down from *pptr to lim,
+//state receives the final state, see aransEncodeSmall
+static int encAransSmall(struct Arans *arans, unsigned char **pptr, const unsigned char *lim, const unsigned char *in,
+                         size_t in_size, uint32_t *state) {
+    encRcpInit();
+
+    struct Range range[CHUNK_SIZE];
+
+    if (in_size > CHUNK_SIZE)
+        return 1;
+
+    for (size_t i = 0; i < in_size; ++i) {
+        unsigned char n = in[i];
+        range[i] = modRange(arans->cdf, n);
+        modUpdate(arans->cdf, n);
+    }
+
+    for (size_t i = in_size; i > 0; --i)
+        if (encPut(state, pptr, lim, range[i - 1]))
+            return 1;
+
+    return 0;
+}
+
+//fills encRcp once per process, every coder that calls encPut runs it first, so the table does not depend on
+//how the model was built and threads starting to code at once all wait for the one fill
+static inline void encRcpInit(void) {
+    pthread_once(&encRcpOnce, encRcpFill);
+}
+
+static void encRcpFill(void) {
+    for (uint64_t w = 1; w <= PROB_SIZE; ++w)
+        encRcp[w] = ((1ull << RCP_SHIFT) + w - 1) / w;
+}
+
+static int encPut(uint32_t *c, unsigned char **pptr, const unsigned char *lim, struct Range range) {
     uint32_t x = *c;
     uint32_t x_max = range.width << (CODE_BITS - PROB_BITS + 8);
 
     if (x >= x_max) {
         unsigned char *ptr = *pptr;
         do {
+            if (ptr <= lim)
+                return 1;
+
             *--ptr = x;
             x >>= 8;
         } while (x >= x_max);
         *pptr = ptr;
     }
 
-    *c = x + (PROB_SIZE - range.width) * (x / range.width) + range.start;
+    //x < width << (CODE_BITS - PROB_BITS + 8) and width <= PROB_SIZE, so x * width < 1 << RCP_SHIFT and the
+    //reciprocal gives x / width exactly, the product stays below 1 << 64 while CODE_BITS + 8 <= 32
+    uint32_t q = (uint32_t) (((uint64_t) x * encRcp[range.width]) >> RCP_SHIFT);
+    *c = x + (PROB_SIZE - range.width) * q + range.start;
     return 0;
 }
 
-static size_t putOriginalSize(unsigned char *out, size_t in_size) {
-    *out++ = in_size >> 24;
-    *out++ = in_size >> 16;
-    *out++ = in_size >> 8;
-    *out++ = in_size;
-
-    return 4;
-}
-
 static int encFlush(const uint32_t *c, unsigned char **pptr, const unsigned char *lim) {
     if (*pptr < &lim[4])
         return 1;
@@ -176,6 +237,12 @@ static inline struct Range modRange(const uint16_t *cdf, unsigned char c) {
     return (struct Range) {cdf[c], cdf[c + 1] - cdf[c]};
 }
 
+//an entry cdf[i] below cdf[ALPH_SIZE] stops moving within 1 << RATE_BITS of its target PROB_SIZE - 1 + i, so it
+//stays below PROB_SIZE while ALPH_SIZE - 1 < 1 << RATE_BITS, the signed compares of modSymb rely on it
+#if ((ALPH_SIZE - 1) >> RATE_BITS)
+#error RATE_BITS too small for the model updates
+#endif
+
 static inline void modUpdate(uint16_t *cdf, unsigned char c) {
 #ifndef __AVX2__
     for (int i = 1; i < ALPH_SIZE; ++i)
@@ -245,68 +312,72 @@ static inline void modUpdate(uint16_t *cdf, unsigned char c) {
 
 // Decoder
 
-// public function declarations
-STORAGE_SPEC size_t aransDecode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+// internal function declarations
+static size_t decAransChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static size_t
+decAransWays(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *, unsigned);
 
-STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *);
+static inline int decAransStep(struct Arans *, unsigned char *, uint32_t *, unsigned char **);
 
-// internal function declarations
-static size_t decChunk(uint16_t *, unsigned char *, size_t, const unsigned char *, size_t);
+static int decAransLevels(struct Arans *, unsigned char *, size_t, const unsigned char *, const size_t *, uint32_t *);
+
+static int decAransLevel(struct Arans *, unsigned, unsigned char *, size_t, size_t, uint32_t *, unsigned char **,
+                         const unsigned char *);
+
+static size_t decChunk(uint16_t *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static size_t decWays(uint16_t *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *, unsigned);
 
 static int decInit(uint32_t *, unsigned char **, const unsigned char *);
 
 static int decPut(uint32_t *, unsigned char **, struct Range);
 
+static int decAransSmall(struct Arans *, unsigned char *, size_t, const unsigned char **, const unsigned char *,
+                         uint32_t *);
+
+static int decSmallPut(uint32_t *, const unsigned char **, const unsigned char *, struct Range);
+
 static inline uint16_t decGet(const uint32_t *);
 
 static unsigned char modSymb(const uint16_t *, uint16_t);
 
-// public functions
-STORAGE_SPEC size_t aransDecode(struct Arans *arans, unsigned char *out, const size_t out_size, const unsigned char *in,
-                                const size_t in_size) {
-    size_t offset = 4;
-    unsigned char *out_cur = out;
-    const unsigned char *in_cur = &in[offset];
-    size_t out_rem = out_size;
-    size_t in_rem = in_size - offset;
-    size_t ret;
-
-    uint16_t ALIGN_ALPH_SIZE(cdf_align[CDF_SIZE + ALIGN_SHIFT]);
-    uint16_t *cdf = &cdf_align[ALIGN_SHIFT];
-    memcpy(cdf, arans->cdf, sizeof(arans->cdf));
-
-    while (out_rem > CHUNK_SIZE) {
-        if (!(ret = decChunk(cdf, out_cur, CHUNK_SIZE, in_cur, in_rem)))
-            return 0;
+// internal functions
+static size_t
+decAransChunk(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc) {
+    return decChunk(arans->cdf, out, out_size, in, in_size, crc);
+}
 
-        in_cur = &in_cur[ret];
-        in_rem -= ret;
-        out_cur = &out_cur[CHUNK_SIZE];
-        out_rem -= CHUNK_SIZE;
-    }
+static size_t
+decAransWays(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+             uint32_t *crc, unsigned ways) {
+    return decWays(arans->cdf, out, out_size, in, in_size, crc, ways);
+}
 
-    if (!(ret = decChunk(cdf, out_cur, out_rem, in_cur, in_rem)))
-        return 0;
+//decodes one symbol of a plain chunk into out, cod holds a state per level,
+//the steps of two chunks may be interleaved, see decPairChunks in arans_stream.h
+static inline int decAransStep(struct Arans *arans, unsigned char *out, uint32_t *cod, unsigned char **pptr) {
+    unsigned char n = modSymb(arans->cdf, decGet(&cod[0]));
 
-    in_rem -= ret;
-    memcpy(arans->cdf, cdf, sizeof(arans->cdf));
-    return in_size - in_rem - offset;
-}
+    struct Range range = modRange(arans->cdf, n);
 
-STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *in) {
-    size_t size = *in++ << 24;
-    size |= *in++ << 16;
-    size |= *in++ << 8;
-    size |= *in;
+    modUpdate(arans->cdf, n);
 
-    return size;
+    if (decPut(&cod[0], pptr, range))
+        return 1;
+
+    *out = n;
+
+    return 0;
 }
 
-// internal functions
 static size_t
-decChunk(uint16_t *cdf, unsigned char *out, const size_t out_size, const unsigned char *in, const size_t in_size) {
+decChunk(uint16_t *cdf, unsigned char *out, const size_t out_size, const unsigned char *in, const size_t in_size,
+         uint32_t *crc) {
     unsigned char *ptr = (unsigned char *) in;
     uint32_t cod;
+    uint32_t sum = crc ? *crc : 0;
 
     if (decInit(&cod, &ptr, &in[in_size]))
         return 0;
@@ -320,14 +391,109 @@ decChunk(uint16_t *cdf, unsigned char *out, const size_t out_size, const unsigne
             return 0;
 
         out[i] = n;
+
+        if (crc)
+            sum = crcByte(sum, out[i]);
     }
 
+    if (crc)
+        *crc = sum;
+
     if (cod != CODE_NORM)
         return 0;
 
     return ptr - in;
 }
 
+//decChunk with ways interleaved states per level, symbol i is decoded by state i % ways,
+//see CHUNK_WAYS in arans_stream.h
+static size_t
+decWays(uint16_t *cdf, unsigned char *out, const size_t out_size, const unsigned char *in, const size_t in_size,
+        uint32_t *crc, unsigned ways) {
+    unsigned char *ptr = (unsigned char *) in;
+    uint32_t cod[WAYS_MAX];
+    uint32_t sum = crc ? *crc : 0;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if (decInit(&cod[w], &ptr, &in[in_size]))
+            return 0;
+
+    for (size_t i = 0; i < out_size; ++i) {
+        unsigned w = i & (ways - 1);
+        unsigned char n = modSymb(cdf, decGet(&cod[w]));
+        struct Range range = modRange(cdf, n);
+        modUpdate(cdf, n);
+
+        if (decPut(&cod[w], &ptr, range))
+            return 0;
+
+        out[i] = n;
+
+        if (crc)
+            sum = crcByte(sum, out[i]);
+    }
+
+    if (crc)
+        *crc = sum;
+
+    for (unsigned w = 0; w < ways; ++w)
+        if (cod[w] != CODE_NORM)
+            return 0;
+
+    return ptr - in;
+}
+
+//decodes a CHUNK_LEVELS chunk, the substreams of the levels follow each other from in, sizes holds their sizes
+static int
+decAransLevels(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in,
+               const size_t *sizes, uint32_t *crc) {
+    return !sizes[0] || (decChunk(arans->cdf, out, out_size, in, sizes[0], crc) != sizes[0]);
+}
+
+//decodes the symbols first to first + count - 1 of one level of a CHUNK_LEVELS chunk into out,
+//the state of the level is read from its substream at *pptr up to lim when first is 0,
+//the only level of this variant is the whole chunk
+static int
+decAransLevel(struct Arans *arans, unsigned level, unsigned char *out, size_t first, size_t count, uint32_t *cod,
+              unsigned char **pptr, const unsigned char *lim) {
+    (void) level;
+
+    if (!first && decInit(cod, pptr, lim))
+        return 1;
+
+    for (size_t i = first; i < first + count; ++i) {
+        unsigned char n = modSymb(arans->cdf, decGet(cod));
+        struct Range range = modRange(arans->cdf, n);
+        modUpdate(arans->cdf, n);
+
+        if (decPut(cod, pptr, range))
+            return 1;
+
+        out[i] = n;
+    }
+
+    return 0;
+}
+
+//decodes out_size bytes coded by encAransSmall from *pptr, reading no further than lim,
+//state holds the final state of the encoder and receives the initial one
+static int decAransSmall(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char **pptr,
+                         const unsigned char *lim, uint32_t *state) {
+    for (size_t i = 0; i < out_size; ++i) {
+        unsigned char n = modSymb(arans->cdf, decGet(state));
+        struct Range range = modRange(arans->cdf, n);
+
+        if (decSmallPut(state, pptr, lim, range))
+            return 1;
+
+        modUpdate(arans->cdf, n);
+
+        out[i] = n;
+    }
+
+    return 0;
+}
+
 static int decInit(uint32_t *c, unsigned char **pptr, const unsigned char *lim) {
     if (*pptr > &lim[-4])
         return 1;
@@ -356,16 +522,52 @@ static int decPut(uint32_t *c, unsigned char **pptr, const struct Range range) {
     return 0;
 }
 
+//decPut that stops reading at lim, the state of a small message starts below CODE_NORM
+static int decSmallPut(uint32_t *c, const unsigned char **pptr, const unsigned char *lim, const struct Range range) {
+    uint32_t x = *c;
+    const unsigned char *ptr = *pptr;
+    x = range.width * (x >> PROB_BITS) + (x & (PROB_SIZE - 1)) - range.start;
+
+    while ((x < CODE_NORM) && (ptr < lim))
+        x = (x << 8) | *ptr++;
+
+    *pptr = ptr;
+    *c = x;
+    return 0;
+}
+
 static inline uint16_t decGet(const uint32_t *c) {
     return *c & (PROB_SIZE - 1);
 }
 
+//the symbol is the number of cdf[i] <= prb for i from 1 to ALPH_SIZE - 1, found without branches
 static unsigned char modSymb(const uint16_t *cdf, const uint16_t prb) {
-    for (int i = 1; i < CDF_SIZE; ++i)
-        if (prb < cdf[i])
-            return i - 1;
+#ifndef __AVX2__
+    unsigned n = 0;
+
+    for (unsigned step = ALPH_SIZE >> 1; step; step >>= 1)
+        n += step & -(unsigned) (cdf[n + step] <= prb);
+
+    return n;
+#else
+    //counts cdf[i] > prb with signed compares, cdf[CDF_SIZE - 1] = PROB_SIZE is negative as a signed value and is
+    //never counted, the other entries and prb are below PROB_SIZE (see modUpdate)
+    const __m256i val = _mm256_set1_epi16((short) prb);
+    int count = 0;
+
+    for (int i = 1; i < CDF_SIZE; i += 32) {
+        __m256i gt1 = _mm256_cmpgt_epi16(_mm256_load_si256((const __m256i *) &cdf[i]), val);
+        __m256i gt2 = _mm256_cmpgt_epi16(_mm256_load_si256((const __m256i *) &cdf[i + 16]), val);
+
+        count += __builtin_popcount((unsigned) _mm256_movemask_epi8(_mm256_packs_epi16(gt1, gt2)));
+    }
+
+    return ALPH_SIZE - 1 - count;
+#endif
 }
 
 // Decoder
 
+#include "arans_stream.h"
+
 #endif //ARANS_ARANS_8_SIMD_H
\ No newline at end of file
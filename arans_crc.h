@@ -0,0 +1,71 @@
+#ifndef ARANS_CRC_H
+#define ARANS_CRC_H
+
+//CRC32C (Castagnoli) of chunk bytes, SSE4.2 crc32 instruction when the target has it, table otherwise,
+//the caller starts from CRC_INIT and inverts the final value
+
+//includes
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+//constants
+#define CRC_INIT 0xFFFFFFFF         //initial crc register
+#define CRC_POLY 0x82F63B78         //reflected Castagnoli polynomial
+#define CRC_SIZE 4                  //number of bytes for a stored crc
+
+#ifndef __SSE4_2__
+static uint32_t crcTable[256];
+#endif
+
+//internal function declarations
+static void crcInit(void);
+
+static inline uint32_t crcByte(uint32_t, unsigned char);
+
+static uint32_t crcBlock(uint32_t, const unsigned char *, size_t);
+
+//internal functions
+static void crcInit(void) {
+#ifndef __SSE4_2__
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t x = i;
+
+        for (int j = 0; j < 8; ++j)
+            x = (x >> 1) ^ (CRC_POLY & -(x & 1));
+
+        crcTable[i] = x;
+    }
+#endif
+}
+
+static inline uint32_t crcByte(uint32_t crc, unsigned char c) {
+#ifdef __SSE4_2__
+    return _mm_crc32_u8(crc, c);
+#else
+    return crcTable[(crc ^ c) & 0xFF] ^ (crc >> 8);
+#endif
+}
+
+static uint32_t crcBlock(uint32_t crc, const unsigned char *in, size_t in_size) {
+    size_t i = 0;
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for (; i + 8 <= in_size; i += 8) {
+        uint64_t x;
+        memcpy(&x, &in[i], 8);
+        crc = _mm_crc32_u64(crc, x);
+    }
+#endif
+
+    for (; i < in_size; ++i)
+        crc = crcByte(crc, in[i]);
+
+    return crc;
+}
+
+#endif //ARANS_CRC_H
@@ -0,0 +1,159 @@
+#ifndef ARANS_DICT_H
+#define ARANS_DICT_H
+
+//primed model states (dictionaries) for inputs too short to adapt the model,
+//included by arans_stream.h
+
+//layout:
+//magic "ARND", version, variant id, RATE_BITS, PROB_BITS, CODE_BITS (one byte each after the magic),
+//big-endian size of struct Arans, big-endian dictionary id, zero padding up to DICT_HEADER_SIZE,
+//then struct Arans as is in native byte order, so a mapped file whose start is aligned like struct Arans
+//can be used in place, aransLoadDict copies the model and takes any buffer
+
+//the dictionary id is the CRC32C of the model bytes, a stream coded from a dictionary records it in its frame
+
+//training runs the model over a corpus and averages the states sampled every TRAIN_STEP bytes,
+//an average of cdfs is still a valid cdf, so the result needs no normalization
+
+//includes
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//constants
+#define DICT_MAGIC "ARND"           //first bytes of every dictionary
+#define DICT_VERSION 1              //version of the dictionary layout
+//position of the model, a multiple of the model alignment (256 bytes for 8_SIMD)
+#define DICT_HEADER_SIZE (alignof(struct Arans) > 64 ? alignof(struct Arans) : 64)
+#define DICT_SIZE (DICT_HEADER_SIZE + sizeof(struct Arans)) //number of bytes of a dictionary
+#define DICT_WORDS (sizeof(struct Arans) / 2) //number of 16-bit words of a model
+
+#ifndef TRAIN_STEP
+#define TRAIN_STEP 256              //number of bytes between sampled model states
+#endif
+
+//public function declarations
+STORAGE_SPEC int aransTrain(struct Arans *, const unsigned char *, size_t);
+
+STORAGE_SPEC size_t aransSaveDict(const struct Arans *, unsigned char *, size_t);
+
+STORAGE_SPEC int aransLoadDict(struct Arans *, uint32_t *, const unsigned char *, size_t);
+
+STORAGE_SPEC const struct Arans *aransMapDict(uint32_t *, const unsigned char *, size_t);
+
+//internal function declarations
+static int dictCheck(uint32_t *, const unsigned char *, size_t);
+
+static uint32_t dictId(const unsigned char *);
+
+//public functions
+STORAGE_SPEC int aransTrain(struct Arans *arans, const unsigned char *in, size_t in_size) {
+    uint64_t *sum = (uint64_t *) calloc(DICT_WORDS, sizeof(uint64_t));
+    uint16_t words[DICT_WORDS];
+    unsigned char out[2 * TRAIN_STEP + 64];
+    uint64_t count = 0;
+
+    if (!sum)
+        return 1;
+
+    aransInit(arans);
+
+    for (size_t i = 0; i < in_size; i += TRAIN_STEP) {
+        size_t symbols = in_size - i < TRAIN_STEP ? in_size - i : TRAIN_STEP;
+
+        //only the model pass matters, the coded bytes are dropped
+        encAransChunk(arans, out, sizeof(out), &in[i], symbols, NULL);
+
+        memcpy(words, arans, sizeof(words));
+        for (size_t j = 0; j < DICT_WORDS; ++j)
+            sum[j] += words[j];
+        ++count;
+    }
+
+    if (count) {
+        for (size_t j = 0; j < DICT_WORDS; ++j)
+            words[j] = sum[j] / count;
+        memcpy(arans, words, sizeof(words));
+    }
+
+    free(sum);
+    return 0;
+}
+
+STORAGE_SPEC size_t aransSaveDict(const struct Arans *arans, unsigned char *out, size_t out_size) {
+    if (out_size < DICT_SIZE)
+        return 0;
+
+    uint32_t size = sizeof(struct Arans);
+    uint32_t id = dictId((const unsigned char *) arans);
+
+    memset(out, 0, DICT_HEADER_SIZE);
+    memcpy(out, DICT_MAGIC, 4);
+    out[4] = DICT_VERSION;
+    out[5] = ARANS_VARIANT;
+    out[6] = RATE_BITS;
+    out[7] = PROB_BITS;
+    out[8] = CODE_BITS;
+    out[9] = size >> 24;
+    out[10] = size >> 16;
+    out[11] = size >> 8;
+    out[12] = size;
+    out[13] = id >> 24;
+    out[14] = id >> 16;
+    out[15] = id >> 8;
+    out[16] = id;
+    memcpy(&out[DICT_HEADER_SIZE], arans, sizeof(struct Arans));
+
+    return DICT_SIZE;
+}
+
+//initializes arans from a dictionary and returns its id, in may have any alignment
+STORAGE_SPEC int aransLoadDict(struct Arans *arans, uint32_t *id, const unsigned char *in, size_t in_size) {
+    if (dictCheck(id, in, in_size))
+        return 1;
+
+    aransInit(arans);
+    memcpy(arans, &in[DICT_HEADER_SIZE], sizeof(struct Arans));
+    return 0;
+}
+
+//checks a dictionary and returns its model in place, NULL when in is not aligned like struct Arans,
+//the model is ready to code from like one of aransLoadDict
+STORAGE_SPEC const struct Arans *aransMapDict(uint32_t *id, const unsigned char *in, size_t in_size) {
+    if (((uintptr_t) in % alignof(struct Arans)) || dictCheck(id, in, in_size))
+        return NULL;
+
+    //aransInit also fills the tables every model shares, such as updateMtx
+    struct Arans init;
+    aransInit(&init);
+
+    return (const struct Arans *) &in[DICT_HEADER_SIZE];
+}
+
+//internal functions
+
+//checks the header and the model bytes of a dictionary and returns its id
+static int dictCheck(uint32_t *id, const unsigned char *in, size_t in_size) {
+    if ((in_size != DICT_SIZE) || memcmp(in, DICT_MAGIC, 4) || (in[4] != DICT_VERSION) ||
+        (in[5] != ARANS_VARIANT) || (in[6] != RATE_BITS) || (in[7] != PROB_BITS) || (in[8] != CODE_BITS))
+        return 1;
+
+    uint32_t size = (uint32_t) in[9] << 24 | in[10] << 16 | in[11] << 8 | in[12];
+    uint32_t stored = (uint32_t) in[13] << 24 | in[14] << 16 | in[15] << 8 | in[16];
+
+    if ((size != sizeof(struct Arans)) || (stored != dictId(&in[DICT_HEADER_SIZE])))
+        return 1;
+
+    *id = stored;
+    return 0;
+}
+
+//model is the bytes of a struct Arans, read without assuming its alignment
+static uint32_t dictId(const unsigned char *model) {
+    //0 marks streams without a dictionary
+    uint32_t id = ~crcBlock(CRC_INIT, model, sizeof(struct Arans));
+    return id ? id : 1;
+}
+
+#endif //ARANS_DICT_H
@@ -0,0 +1,208 @@
+#ifndef ARANS_JOBS_H
+#define ARANS_JOBS_H
+
+//job queue: callers submit encode and decode jobs to a bounded ring and return at once, a fixed set of worker
+//threads takes the jobs in order and codes them with aransEncodeEx/aransDecodeEx, so jobs of many callers share
+//the same threads, included at the end of arans_stream.h
+
+//a job belongs to its caller until it completes: the worker sets result, calls done and then adds 1 to fd,
+//an eventfd or any descriptor that takes an 8-byte write, so the caller may wait on a callback or poll for it,
+//the job must not be touched between the submit and its completion, jobs in flight need models of their own,
+//their options should keep threads at 1, every job runs on a single worker
+
+//includes
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+//constants
+#define JOB_ENCODE 1                //job codes in into a stream in out
+#define JOB_DECODE 2                //job decodes the stream in into out
+
+//types
+struct AransJob;
+
+typedef void (*AransDone)(struct AransJob *);
+
+//structs
+struct AransJob {
+    int type;                       //JOB_* value
+    struct Arans *arans;            //model the job starts from, receives the final one like in aransEncodeEx
+    const struct AransOptions *options; //NULL - the options of aransEncode/aransDecode
+    unsigned char *out;
+    size_t out_size;
+    const unsigned char *in;
+    size_t in_size;
+
+    size_t result;                  //return value of aransEncodeEx or aransDecodeEx, 0 - failure
+    AransDone done;                 //called by the worker when the job completes, NULL - none
+    void *ctx;                      //left to done
+    int fd;                         //descriptor that receives 1 when the job completes, -1 - none
+};
+
+struct AransQueue {
+    pthread_mutex_t mtx;
+    pthread_cond_t ready;           //signalled when a job is queued or the queue stops
+    pthread_cond_t idle;            //signalled when the last job in flight completes
+    pthread_t *workers;
+    int count;                      //number of worker threads
+    int stop;
+
+    struct AransJob **jobs;         //ring of queued jobs
+    size_t capacity;
+    size_t head;                    //next job to take
+    size_t size;                    //number of queued jobs
+    size_t running;                 //number of jobs taken by workers
+};
+
+//public function declarations
+STORAGE_SPEC struct AransQueue *aransQueueCreate(int, size_t);
+
+STORAGE_SPEC int aransQueueSubmit(struct AransQueue *, struct AransJob *);
+
+STORAGE_SPEC void aransQueueWait(struct AransQueue *);
+
+STORAGE_SPEC void aransQueueDestroy(struct AransQueue *);
+
+//internal function declarations
+static void *queueWorker(void *);
+
+static void queueRun(struct AransJob *);
+
+//public functions
+
+//starts threads workers for a ring of capacity jobs
+STORAGE_SPEC struct AransQueue *aransQueueCreate(int threads, size_t capacity) {
+    struct AransQueue *queue = (struct AransQueue *) calloc(1, sizeof(struct AransQueue));
+
+    if (!queue)
+        return NULL;
+
+    pthread_mutex_init(&queue->mtx, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    pthread_cond_init(&queue->idle, NULL);
+
+    queue->capacity = capacity ? capacity : 1;
+    queue->jobs = (struct AransJob **) malloc(queue->capacity * sizeof(struct AransJob *));
+    queue->workers = (pthread_t *) malloc((threads > 1 ? threads : 1) * sizeof(pthread_t));
+
+    if (!queue->jobs || !queue->workers) {
+        aransQueueDestroy(queue);
+        return NULL;
+    }
+
+    for (int i = 0; i < (threads > 1 ? threads : 1); ++i) {
+        if (pthread_create(&queue->workers[i], NULL, queueWorker, queue))
+            break;
+        ++queue->count;
+    }
+
+    if (!queue->count) {
+        aransQueueDestroy(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+//queues job without waiting, fails when the ring is full or the queue stops, so the caller keeps the job
+STORAGE_SPEC int aransQueueSubmit(struct AransQueue *queue, struct AransJob *job) {
+    int ret = 1;
+
+    pthread_mutex_lock(&queue->mtx);
+    if (!queue->stop && (queue->size < queue->capacity)) {
+        queue->jobs[(queue->head + queue->size++) % queue->capacity] = job;
+        pthread_cond_signal(&queue->ready);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&queue->mtx);
+
+    return ret;
+}
+
+//waits until every submitted job has completed
+STORAGE_SPEC void aransQueueWait(struct AransQueue *queue) {
+    pthread_mutex_lock(&queue->mtx);
+    while (queue->size || queue->running)
+        pthread_cond_wait(&queue->idle, &queue->mtx);
+    pthread_mutex_unlock(&queue->mtx);
+}
+
+//completes the queued jobs and stops the workers
+STORAGE_SPEC void aransQueueDestroy(struct AransQueue *queue) {
+    pthread_mutex_lock(&queue->mtx);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->mtx);
+
+    for (int i = 0; i < queue->count; ++i)
+        pthread_join(queue->workers[i], NULL);
+
+    pthread_cond_destroy(&queue->idle);
+    pthread_cond_destroy(&queue->ready);
+    pthread_mutex_destroy(&queue->mtx);
+    free(queue->workers);
+    free(queue->jobs);
+    free(queue);
+}
+
+//internal functions
+static void *queueWorker(void *arg) {
+    struct AransQueue *queue = (struct AransQueue *) arg;
+
+    pthread_mutex_lock(&queue->mtx);
+    for (;;) {
+        while (!queue->stop && !queue->size)
+            pthread_cond_wait(&queue->ready, &queue->mtx);
+
+        //a stopped queue still runs the jobs it holds
+        if (!queue->size)
+            break;
+
+        struct AransJob *job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        --queue->size;
+        ++queue->running;
+        pthread_mutex_unlock(&queue->mtx);
+
+        queueRun(job);
+
+        pthread_mutex_lock(&queue->mtx);
+        if (!--queue->running && !queue->size)
+            pthread_cond_broadcast(&queue->idle);
+    }
+    pthread_mutex_unlock(&queue->mtx);
+
+    aransScratchFree();
+    return NULL;
+}
+
+//codes job and reports its completion, the job is not touched after the write to fd
+static void queueRun(struct AransJob *job) {
+    struct AransOptions options;
+    const struct AransOptions *opts = job->options;
+    int fd = job->fd;
+
+    if (!opts) {
+        aransDefaultOptions(&options);
+        opts = &options;
+    }
+
+    if (job->type == JOB_ENCODE)
+        job->result = aransEncodeEx(job->arans, opts, job->out, job->out_size, job->in, job->in_size);
+    else if (job->type == JOB_DECODE)
+        job->result = aransDecodeEx(job->arans, opts, job->out, job->out_size, job->in, job->in_size);
+    else
+        job->result = 0;
+
+    if (job->done)
+        job->done(job);
+
+    if (fd >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(fd, &one, sizeof(one));
+        (void) ret;
+    }
+}
+
+#endif //ARANS_JOBS_H
@@ -0,0 +1,588 @@
+#ifndef ARANS_PIPE_H
+#define ARANS_PIPE_H
+
+//file coding as a pipeline: a reader thread fills blocks, worker threads code them and the calling thread
+//writes them in order, the blocks go round a ring of PIPE_DEPTH slots, so memory depends on the number of workers
+//and the block size and not on the file size, included at the end of arans_stream.h
+
+//an encoder block is a segment, or PIPE_CHUNKS chunks when the stream has one segment,
+//a decoder block starts at a model reset or snapshot, or after PIPE_CHUNKS chunks of the block before it,
+//a block that does not start a segment continues the model of the block before it, so it is coded after it
+//and only the reading and writing overlap, the streams are the same as the ones of aransEncodeEx,
+//with options->split one worker codes the blocks and the threads run the backward passes of its chunks,
+//with options->levels one worker decodes the blocks and the threads run the levels of its chunks
+
+//includes
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdio.h>
+
+//constants
+#ifndef PIPE_CHUNKS
+#define PIPE_CHUNKS 64              //max number of chunks per block of a segment split into blocks
+#endif
+
+#define PIPE_DEPTH(W) (2 * (W) + 1) //number of slots for W workers, the reader and the writer have one more each
+
+#define SLOT_FREE 0                 //slot waits for the reader
+#define SLOT_READ 1                 //block is read and waits for a worker
+#define SLOT_DONE 2                 //block is coded and waits for the writer
+
+//structs
+struct PipeSlot {
+    size_t block;                   //number of the block in the slot
+    int state;                      //SLOT_* value
+    int keep;                       //the next block has not taken the model after this one yet
+    unsigned char *in;
+    size_t in_size;
+    unsigned char *out;
+    size_t size;                    //number of bytes coded or decoded into out
+    struct AransChunk *chunks;
+    size_t count;
+    struct Arans model;             //model after the block
+};
+
+struct Pipe {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;            //broadcast on every slot change
+    struct PipeSlot *slots;
+    size_t depth;
+    size_t blocks;
+    size_t next;                    //next block handed to a worker
+    size_t out_size;                //number of bytes of out in every slot
+    int workers;                    //number of threads coding blocks
+    int failed;
+
+    const struct AransOptions *options;
+    struct Arans base;              //model every segment starts from
+    FILE *in;
+    FILE *out;
+    uint64_t out_pos;               //number of bytes written
+    struct AransIndex index;        //encoder: entries written so far, decoder: the whole index
+    size_t *firsts;                 //decoder: first index entry of every block, blocks + 1 values
+    size_t chunks;                  //encoder: number of chunks per block
+    int segments;                   //encoder: every block is a segment
+    struct AransPool *pool;         //pool of the split backward passes or of the levels, NULL - none
+    int *cpus;                      //with options->pin: CPUs worker i is pinned to in turn
+    int cpu_count;
+    atomic_int joined;              //number of workers started
+
+    int (*read)(struct Pipe *, struct PipeSlot *);
+    int (*code)(struct Pipe *, struct PipeSlot *, struct Arans *);
+    int (*write)(struct Pipe *, struct PipeSlot *);
+    int (*chained)(const struct Pipe *, size_t);
+};
+
+// Pipeline
+
+//internal function declarations
+static struct Pipe *pipeCreate(void);
+
+static int pipeRun(struct Pipe *, size_t, size_t, size_t);
+
+static void pipeFree(struct Pipe *);
+
+static void *pipeReader(void *);
+
+static void *pipeWorker(void *);
+
+//internal functions
+
+//the pipe and its slots hold models, which may be over-aligned (see arans_8_SIMD.h)
+static struct Pipe *pipeCreate(void) {
+    struct Pipe *pipe = (struct Pipe *) aligned_alloc(alignof(struct Pipe), sizeof(struct Pipe));
+
+    if (pipe)
+        memset(pipe, 0, sizeof(struct Pipe));
+
+    return pipe;
+}
+
+//allocates slots of in_size and out_size bytes with room for entries index entries (0 - left to the coder),
+//runs the reader and the workers and writes the blocks in order
+static int pipeRun(struct Pipe *pipe, size_t in_size, size_t out_size, size_t entries) {
+    size_t workers = pipe->workers > 1 ? pipe->workers : 1;
+
+    if (workers > pipe->blocks)
+        workers = pipe->blocks ? pipe->blocks : 1;
+
+    pipe->depth = PIPE_DEPTH(workers);
+    pipe->out_size = out_size;
+    pipe->slots = (struct PipeSlot *) aligned_alloc(alignof(struct PipeSlot), pipe->depth * sizeof(struct PipeSlot));
+
+    if (!pipe->slots)
+        return 1;
+
+    memset(pipe->slots, 0, pipe->depth * sizeof(struct PipeSlot));
+
+    for (size_t i = 0; i < pipe->depth; ++i) {
+        struct PipeSlot *slot = &pipe->slots[i];
+
+        slot->in = (unsigned char *) malloc(in_size + 1);
+        slot->out = (unsigned char *) malloc(out_size + 1);
+        slot->chunks = entries ? (struct AransChunk *) malloc(entries * sizeof(struct AransChunk)) : NULL;
+
+        if (!slot->in || !slot->out || (entries && !slot->chunks))
+            return 1;
+    }
+
+    pthread_t reader;
+    pthread_t threads[workers];
+    size_t started = 0;
+
+    //the workers take the CPUs after the ones of the pool workers
+    if (pipe->options->pin) {
+        pipe->cpus = (int *) malloc(POOL_CPUS_MAX * sizeof(int));
+
+        if (!pipe->cpus || !(pipe->cpu_count = poolCpus(pipe->cpus, pipe->options->node)))
+            return 1;
+    }
+
+    pthread_mutex_init(&pipe->mtx, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    int ret = pthread_create(&reader, NULL, pipeReader, pipe);
+
+    while (!ret && (started < workers) && !pthread_create(&threads[started], NULL, pipeWorker, pipe))
+        ++started;
+
+    //the calling thread is the writer, a block is written once the next block has taken its model
+    for (size_t k = 0; !ret && started && (k < pipe->blocks); ++k) {
+        struct PipeSlot *slot = &pipe->slots[k % pipe->depth];
+
+        pthread_mutex_lock(&pipe->mtx);
+
+        while (!pipe->failed && ((slot->block != k) || (slot->state != SLOT_DONE) || slot->keep))
+            pthread_cond_wait(&pipe->cond, &pipe->mtx);
+
+        int failed = pipe->failed;
+        pthread_mutex_unlock(&pipe->mtx);
+
+        if (failed)
+            break;
+
+        failed = pipe->write(pipe, slot);
+
+        pthread_mutex_lock(&pipe->mtx);
+        pipe->failed |= failed;
+        slot->state = SLOT_FREE;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mtx);
+    }
+
+    //a thread that did not start stops the others
+    pthread_mutex_lock(&pipe->mtx);
+    pipe->failed |= ret || !started;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mtx);
+
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    if (!ret)
+        pthread_join(reader, NULL);
+
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mtx);
+    return pipe->failed;
+}
+
+static void pipeFree(struct Pipe *pipe) {
+    for (size_t i = 0; pipe->slots && (i < pipe->depth); ++i) {
+        free(pipe->slots[i].in);
+        free(pipe->slots[i].out);
+        free(pipe->slots[i].chunks);
+    }
+
+    free(pipe->slots);
+    free(pipe->firsts);
+    free(pipe->cpus);
+    aransFreeIndex(&pipe->index);
+}
+
+static void *pipeReader(void *arg) {
+    struct Pipe *pipe = (struct Pipe *) arg;
+
+    for (size_t k = 0; k < pipe->blocks; ++k) {
+        struct PipeSlot *slot = &pipe->slots[k % pipe->depth];
+
+        //a slot is free once the block depth blocks before has been written
+        pthread_mutex_lock(&pipe->mtx);
+
+        while (!pipe->failed && (slot->state != SLOT_FREE))
+            pthread_cond_wait(&pipe->cond, &pipe->mtx);
+
+        int failed = pipe->failed;
+        slot->block = k;
+        pthread_mutex_unlock(&pipe->mtx);
+
+        if (failed)
+            break;
+
+        failed = pipe->read(pipe, slot);
+
+        pthread_mutex_lock(&pipe->mtx);
+        pipe->failed |= failed;
+        slot->state = SLOT_READ;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mtx);
+    }
+
+    return NULL;
+}
+
+static void *pipeWorker(void *arg) {
+    struct Pipe *pipe = (struct Pipe *) arg;
+    int self = atomic_fetch_add(&pipe->joined, 1) + (pipe->pool ? pipe->pool->count : 0);
+    struct Arans model;
+
+    if (pipe->cpu_count)
+        poolPin(pipe->cpus[self % pipe->cpu_count]);
+
+    pthread_mutex_lock(&pipe->mtx);
+
+    while (!pipe->failed && (pipe->next < pipe->blocks)) {
+        size_t k = pipe->next++;
+        struct PipeSlot *slot = &pipe->slots[k % pipe->depth];
+        struct PipeSlot *prev = &pipe->slots[(k + pipe->depth - 1) % pipe->depth];
+        int chained = pipe->chained(pipe, k);
+
+        //a chained block starts from the model after the block before it, which keeps its slot until then
+        while (!pipe->failed && ((slot->block != k) || (slot->state != SLOT_READ) ||
+                                 (chained && ((prev->block != k - 1) || (prev->state != SLOT_DONE)))))
+            pthread_cond_wait(&pipe->cond, &pipe->mtx);
+
+        if (pipe->failed)
+            break;
+
+        model = chained ? prev->model : pipe->base;
+        prev->keep &= !chained;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mtx);
+
+        int failed = pipe->code(pipe, slot, &model);
+
+        pthread_mutex_lock(&pipe->mtx);
+        pipe->failed |= failed;
+        slot->model = model;
+        slot->keep = (k + 1 < pipe->blocks) && pipe->chained(pipe, k + 1);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+
+    pthread_mutex_unlock(&pipe->mtx);
+    aransScratchFree();
+    return NULL;
+}
+
+// Pipeline
+
+
+// Encoder
+
+//public function declarations
+STORAGE_SPEC int aransEncodeFile(struct Arans *, const struct AransOptions *, FILE *, uint64_t, FILE *, uint64_t *);
+
+//internal function declarations
+static int pipeEncRead(struct Pipe *, struct PipeSlot *);
+
+static int pipeEncCode(struct Pipe *, struct PipeSlot *, struct Arans *);
+
+static int pipeEncWrite(struct Pipe *, struct PipeSlot *);
+
+static int pipeEncChained(const struct Pipe *, size_t);
+
+//public functions
+
+//codes in_size bytes of in into out and returns the stream size in out_size,
+//arans holds the model to start from and receives the final model like in aransEncodeEx
+STORAGE_SPEC int aransEncodeFile(struct Arans *arans, const struct AransOptions *options, FILE *in, uint64_t in_size,
+                                 FILE *out, uint64_t *out_size) {
+    uint64_t chunks = (in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    struct Pipe *pipe = pipeCreate();
+    unsigned char head[FRAME_MAX_SIZE];
+
+    if (!pipe || (in_size > SIZE_MAX)) {
+        free(pipe);
+        return 1;
+    }
+
+    pipe->options = options;
+    pipe->base = *arans;
+    pipe->in = in;
+    pipe->out = out;
+    pipe->workers = options->split ? 1 : options->threads;
+    pipe->segments = options->segment && (options->segment < chunks);
+    pipe->chunks = pipe->segments ? options->segment : PIPE_CHUNKS;
+    pipe->blocks = (chunks + pipe->chunks - 1) / pipe->chunks;
+    pipe->read = pipeEncRead;
+    pipe->code = pipeEncCode;
+    pipe->write = pipeEncWrite;
+    pipe->chained = pipeEncChained;
+
+    struct AransIndex *index = &pipe->index;
+    index->frame.flags = (options->checksum ? FRAME_CHECKSUM : 0) | (options->dict ? FRAME_DICT : 0) |
+                         (options->append ? FRAME_APPEND : 0);
+    index->frame.size = in_size;
+
+    size_t block_size = pipe->chunks * CHUNK_SIZE;
+    size_t size = putFrame(head, in_size, index->frame.flags, options->dict);
+    int ret = fwrite(head, size, 1, out) != 1;
+
+    pipe->out_pos = size;
+
+    if (options->split && (options->threads > 1))
+        ret |= !(pipe->pool = options->pool ? options->pool : optionsPool(options, options->threads));
+
+    if (!ret)
+        ret = pipeRun(pipe, block_size, encSegmentBound(block_size, options->checkpoint), 0);
+
+    if (!ret && pipe->blocks)
+        *arans = pipe->slots[(pipe->blocks - 1) % pipe->depth].model;
+
+    //the final model of an appendable stream and the index follow the last block
+    size_t bound = (index->count + 1) * INDEX_ENTRY_BOUND + VARINT_MAX_SIZE + INDEX_TAIL_SIZE + MODEL_BOUND;
+    unsigned char *tail = ret ? NULL : (unsigned char *) malloc(bound);
+    struct AransChunk *grown = (struct AransChunk *) realloc(index->chunks, (index->count + 1) *
+                                                                            sizeof(struct AransChunk));
+
+    if (grown)
+        index->chunks = grown;
+
+    if (tail && grown) {
+        size_t pos = 0;
+
+        if (index->frame.flags & FRAME_APPEND) {
+            pos = putModel(tail, bound, arans, &pipe->base);
+            index->chunks[index->count++] = (struct AransChunk) {pipe->out_pos, pos, 0, CHUNK_MODEL, 0};
+        }
+
+        size = putIndex(&tail[pos], bound - pos, index);
+        ret = ((index->frame.flags & FRAME_APPEND) && !pos) || !size || (fwrite(tail, pos + size, 1, out) != 1);
+        *out_size = pipe->out_pos + pos + size;
+    } else {
+        ret = 1;
+    }
+
+    if (pipe->pool && !options->pool)
+        aransPoolDestroy(pipe->pool);
+
+    pipeFree(pipe);
+    free(pipe);
+    free(tail);
+    return ret;
+}
+
+//internal functions
+static int pipeEncRead(struct Pipe *pipe, struct PipeSlot *slot) {
+    uint64_t pos = (uint64_t) slot->block * pipe->chunks * CHUNK_SIZE;
+    uint64_t rest = pipe->index.frame.size - pos;
+
+    slot->in_size = rest < pipe->chunks * CHUNK_SIZE ? rest : pipe->chunks * CHUNK_SIZE;
+    return fread(slot->in, slot->in_size, 1, pipe->in) != 1;
+}
+
+static int pipeEncCode(struct Pipe *pipe, struct PipeSlot *slot, struct Arans *model) {
+    struct AransOptions options = *pipe->options;
+    struct AransIndex index = {{0}, 0, slot->chunks};
+
+    //the block is one segment coded without a pool of its own, a chained block continues the segment
+    options.segment = 0;
+    options.threads = pipe->pool ? options.threads : 1;
+    options.pool = pipe->pool;
+
+    size_t prior = pipe->segments ? 0 : slot->block * pipe->chunks;
+
+    slot->size = encStream(model, &pipe->base, &options, prior, slot->out, pipe->out_size, 0, slot->in, slot->in_size,
+                           &index);
+    slot->chunks = index.chunks;
+    slot->count = index.count;
+    return !slot->size;
+}
+
+static int pipeEncWrite(struct Pipe *pipe, struct PipeSlot *slot) {
+    struct AransIndex *index = &pipe->index;
+    struct AransChunk *grown = (struct AransChunk *) realloc(index->chunks, (index->count + slot->count) *
+                                                                            sizeof(struct AransChunk));
+
+    if (!grown)
+        return 1;
+
+    index->chunks = grown;
+
+    for (size_t i = 0; i < slot->count; ++i) {
+        index->chunks[index->count] = slot->chunks[i];
+        index->chunks[index->count++].offset += pipe->out_pos;
+    }
+
+    pipe->out_pos += slot->size;
+    return fwrite(slot->out, slot->size, 1, pipe->out) != 1;
+}
+
+static int pipeEncChained(const struct Pipe *pipe, size_t block) {
+    return block && !pipe->segments;
+}
+
+// Encoder
+
+
+// Decoder
+
+//public function declarations
+STORAGE_SPEC int aransDecodeFile(struct Arans *, const struct AransOptions *, FILE *, uint64_t, FILE *, uint64_t *);
+
+//internal function declarations
+static int pipeDecRead(struct Pipe *, struct PipeSlot *);
+
+static int pipeDecCode(struct Pipe *, struct PipeSlot *, struct Arans *);
+
+static int pipeDecWrite(struct Pipe *, struct PipeSlot *);
+
+static int pipeDecChained(const struct Pipe *, size_t);
+
+//public functions
+
+//decodes the in_size byte stream in into out and returns the original size in out_size,
+//only the frame header, the index and the blocks in the ring are held in memory,
+//arans holds the model passed to the encoder and receives the final model like in aransDecodeEx
+STORAGE_SPEC int aransDecodeFile(struct Arans *arans, const struct AransOptions *options, FILE *in, uint64_t in_size,
+                                 FILE *out, uint64_t *out_size) {
+    unsigned char head[FRAME_MAX_SIZE];
+    unsigned char tail_size_bytes[INDEX_TAIL_SIZE];
+    size_t head_size = in_size < FRAME_MAX_SIZE ? in_size : FRAME_MAX_SIZE;
+
+    if ((in_size > SIZE_MAX) || (in_size < INDEX_TAIL_SIZE) || fseek(in, 0, SEEK_SET) ||
+        (fread(head, head_size, 1, in) != 1) || fseek(in, in_size - INDEX_TAIL_SIZE, SEEK_SET) ||
+        (fread(tail_size_bytes, INDEX_TAIL_SIZE, 1, in) != 1))
+        return 1;
+
+    //the index size, then the index before it
+    size_t tail_size = ((size_t) tail_size_bytes[0] << 24 | tail_size_bytes[1] << 16 | tail_size_bytes[2] << 8 |
+                        tail_size_bytes[3]) + INDEX_TAIL_SIZE;
+    unsigned char *tail = tail_size <= in_size ? (unsigned char *) malloc(tail_size) : NULL;
+    struct Pipe *pipe = pipeCreate();
+
+    if (!tail || !pipe || fseek(in, in_size - tail_size, SEEK_SET) || (fread(tail, tail_size, 1, in) != 1) ||
+        getIndex(&pipe->index, head, head_size, tail, tail_size, in_size)) {
+        free(tail);
+        free(pipe);
+        return 1;
+    }
+
+    free(tail);
+
+    struct AransIndex *index = &pipe->index;
+    uint64_t size = 0;
+    size_t max_in = 0;
+    size_t max_out = 0;
+
+    pipe->firsts = (size_t *) malloc((index->count + 1) * sizeof(size_t));
+
+    //blocks split at resets and snapshots and every PIPE_CHUNKS chunks, the end closes the last one
+    for (size_t i = 0, chunks = 0; pipe->firsts && (i <= index->count); ++i) {
+        const struct AransChunk *chunk = &index->chunks[i];
+
+        if (!i || (i == index->count) || (chunk->flags & (CHUNK_RESET | CHUNK_MODEL)) || (chunks == PIPE_CHUNKS)) {
+            if (i) {
+                size_t first = pipe->firsts[pipe->blocks - 1];
+                size_t block_in = chunk[-1].offset + chunk[-1].size - index->chunks[first].offset;
+                size_t block_out = 0;
+
+                for (size_t j = first; j < i; ++j)
+                    block_out += index->chunks[j].symbols;
+
+                max_in = block_in > max_in ? block_in : max_in;
+                max_out = block_out > max_out ? block_out : max_out;
+            }
+
+            pipe->firsts[pipe->blocks++] = i;
+            chunks = 0;
+        }
+
+        if (i < index->count) {
+            chunks += !(chunk->flags & CHUNK_MODEL);
+            size += chunk->symbols;
+        }
+    }
+
+    int ret = 1;
+    int levels = options->levels && (RANGE_LEVELS > 1) && (options->threads > 1);
+
+    if (levels && !(pipe->pool = options->pool ? options->pool : optionsPool(options, options->threads)))
+        levels = 0;
+
+    //the model must start from the dictionary the stream was coded with
+    if (pipe->firsts && (size == index->frame.size) && (index->frame.dict == options->dict)) {
+        pipe->blocks -= 1;
+        pipe->options = options;
+        pipe->base = *arans;
+        pipe->in = in;
+        pipe->out = out;
+        pipe->workers = levels ? 1 : options->threads;
+        pipe->read = pipeDecRead;
+        pipe->code = pipeDecCode;
+        pipe->write = pipeDecWrite;
+        pipe->chained = pipeDecChained;
+
+        ret = pipeRun(pipe, max_in, max_out, PIPE_CHUNKS + 1);
+
+        if (!ret && pipe->blocks)
+            *arans = pipe->slots[(pipe->blocks - 1) % pipe->depth].model;
+
+        *out_size = pipe->out_pos;
+    }
+
+    if (pipe->pool && !options->pool)
+        aransPoolDestroy(pipe->pool);
+
+    pipeFree(pipe);
+    free(pipe);
+    return ret;
+}
+
+//internal functions
+static int pipeDecRead(struct Pipe *pipe, struct PipeSlot *slot) {
+    const struct AransIndex *index = &pipe->index;
+    size_t first = pipe->firsts[slot->block];
+    size_t last = pipe->firsts[slot->block + 1];
+    size_t offset = index->chunks[first].offset;
+
+    slot->in_size = index->chunks[last - 1].offset + index->chunks[last - 1].size - offset;
+    slot->count = last - first;
+
+    //the entries of a slot point into its own bytes
+    for (size_t i = 0; i < slot->count; ++i) {
+        slot->chunks[i] = index->chunks[first + i];
+        slot->chunks[i].offset -= offset;
+    }
+
+    return fseek(pipe->in, offset, SEEK_SET) || (slot->in_size && (fread(slot->in, slot->in_size, 1, pipe->in) != 1));
+}
+
+static int pipeDecCode(struct Pipe *pipe, struct PipeSlot *slot, struct Arans *model) {
+    int checksum = pipe->index.frame.flags & FRAME_CHECKSUM;
+
+    slot->size = 0;
+
+    for (size_t i = 0; i < slot->count; ++i) {
+        if (decEntry(model, &pipe->base, &slot->out[slot->size], slot->in, &slot->chunks[i], checksum, pipe->pool))
+            return 1;
+
+        slot->size += slot->chunks[i].symbols;
+    }
+
+    return 0;
+}
+
+static int pipeDecWrite(struct Pipe *pipe, struct PipeSlot *slot) {
+    pipe->out_pos += slot->size;
+    return slot->size && (fwrite(slot->out, slot->size, 1, pipe->out) != 1);
+}
+
+static int pipeDecChained(const struct Pipe *pipe, size_t block) {
+    return block && !(pipe->index.chunks[pipe->firsts[block]].flags & (CHUNK_RESET | CHUNK_MODEL));
+}
+
+// Decoder
+
+#endif //ARANS_PIPE_H
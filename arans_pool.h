@@ -0,0 +1,486 @@
+#ifndef ARANS_POOL_H
+#define ARANS_POOL_H
+
+//fixed set of worker threads running parallel loops over task indices,
+//the calling thread takes part in every loop, so a pool of one thread has no workers
+
+//aransPoolSteal runs a loop whose tasks may add tasks of their own with aransPoolSpawn: every thread has a deque,
+//the loop deals its tasks to the deques in turn, a thread takes the newest task of its own deque
+//and when it runs dry the oldest task of another one, so a task that spawns many keeps the whole pool busy
+
+//aransPoolCreatePinned pins worker i to the i-th CPU the process may run on, or to the i-th CPU of a NUMA node,
+//so the models, ranges and tables a worker keeps touching stay in the caches of its core, pinning needs cpu_set_t
+//(_GNU_SOURCE on glibc) and fails without it
+
+//threadScratch keeps SCRATCH_SLOTS buffers per thread and hands the same one out again when it is large enough,
+//so the buffers of the coder are first touched by the thread using them, on its node, and stay warm between calls,
+//workers free theirs when they stop, other threads with aransScratchFree
+
+//includes
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//constants
+#define POOL_ALL_NODES (-1)         //pin to any CPU the process may run on
+#define POOL_CPUS_MAX 1024          //max number of CPUs a pool pins to
+#define SCRATCH_SLOTS 4             //number of scratch buffers kept per thread
+#define SCRATCH_ALIGN 64            //min alignment of a scratch buffer
+
+//types
+typedef void (*AransTask)(void *, size_t);
+
+//structs
+struct PoolTask {
+    AransTask task;
+    void *ctx;
+    size_t i;
+};
+
+struct PoolDeque {
+    pthread_mutex_t mtx;
+    struct PoolTask *tasks;
+    size_t capacity;
+    size_t head;                    //oldest task, taken by other threads
+    size_t size;                    //number of tasks, the newest one is taken by the owner
+};
+
+struct PoolScratch {
+    void *ptr;
+    size_t size;
+};
+
+struct AransPool {
+    pthread_mutex_t mtx;
+    pthread_cond_t start;           //signalled when a loop is published or the pool stops
+    pthread_cond_t done;            //signalled when the last worker leaves a loop
+    pthread_t *workers;
+    int count;                      //number of worker threads
+    int stop;
+    unsigned long generation;       //incremented for every published loop
+    size_t pending;                 //workers still inside the current loop
+
+    AransTask task;
+    void *ctx;
+    size_t total;
+    atomic_size_t next;             //next task index to hand out
+
+    int steal;                      //the current loop runs on the deques
+    struct PoolDeque *deques;       //count + 1 deques, the last one belongs to the calling thread
+    atomic_size_t active;           //tasks of the loop queued or running
+    atomic_int joined;              //number of workers that have taken a deque
+
+    int *cpus;                      //CPUs worker i is pinned to in turn
+    int cpu_count;                  //number of cpus, 0 - workers are not pinned
+};
+
+//public function declarations
+STORAGE_SPEC struct AransPool *aransPoolCreate(int);
+
+STORAGE_SPEC struct AransPool *aransPoolCreatePinned(int, int);
+
+STORAGE_SPEC void aransPoolRun(struct AransPool *, size_t, AransTask, void *);
+
+STORAGE_SPEC int aransPoolSteal(struct AransPool *, size_t, AransTask, void *);
+
+STORAGE_SPEC int aransPoolSpawn(struct AransPool *, AransTask, void *, size_t);
+
+STORAGE_SPEC void aransPoolDestroy(struct AransPool *);
+
+STORAGE_SPEC void aransScratchFree(void);
+
+//internal function declarations
+static struct AransPool *poolCreate(int, int *, int);
+
+static int poolCpus(int *, int);
+
+static int poolPin(int);
+
+static void *threadScratch(int, size_t, size_t);
+
+static void *poolWorker(void *);
+
+static void poolDrain(struct AransPool *);
+
+static void poolSteal(struct AransPool *, int);
+
+static int dequePush(struct PoolDeque *, struct PoolTask);
+
+static int dequePop(struct PoolDeque *, struct PoolTask *, int);
+
+//deque of the thread running a task of aransPoolSteal, NULL - none
+static _Thread_local struct PoolDeque *poolDeque;
+
+//buffers of threadScratch
+static _Thread_local struct PoolScratch poolScratch[SCRATCH_SLOTS];
+
+//public functions
+STORAGE_SPEC struct AransPool *aransPoolCreate(int threads) {
+    return poolCreate(threads, NULL, 0);
+}
+
+//creates a pool whose workers are pinned to the CPUs of node, or to all CPUs of the process with POOL_ALL_NODES,
+//the calling thread is left as it is, fails when there is no such CPU
+STORAGE_SPEC struct AransPool *aransPoolCreatePinned(int threads, int node) {
+    int *cpus = (int *) malloc(POOL_CPUS_MAX * sizeof(int));
+    int count = cpus ? poolCpus(cpus, node) : 0;
+
+    if (!count) {
+        free(cpus);
+        return NULL;
+    }
+
+    return poolCreate(threads, cpus, count);
+}
+
+STORAGE_SPEC void aransPoolRun(struct AransPool *pool, size_t total, AransTask task, void *ctx) {
+    pthread_mutex_lock(&pool->mtx);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->total = total;
+    pool->steal = 0;
+    atomic_store(&pool->next, 0);
+    pool->pending = pool->count;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mtx);
+
+    poolDrain(pool);
+
+    pthread_mutex_lock(&pool->mtx);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->mtx);
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+//runs tasks 0 to total - 1 and every task they spawn, returns when all of them are done,
+//fails when the deques cannot hold the tasks, the tasks dealt until then still run
+STORAGE_SPEC int aransPoolSteal(struct AransPool *pool, size_t total, AransTask task, void *ctx) {
+    int ret = 0;
+
+    atomic_store(&pool->active, total);
+
+    for (size_t i = 0; i < total; ++i)
+        if (dequePush(&pool->deques[i % (pool->count + 1)], (struct PoolTask) {task, ctx, i})) {
+            atomic_fetch_sub(&pool->active, total - i);
+            ret = 1;
+            break;
+        }
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->steal = 1;
+    pool->pending = pool->count;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mtx);
+
+    poolSteal(pool, pool->count);
+
+    pthread_mutex_lock(&pool->mtx);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->mtx);
+    pthread_mutex_unlock(&pool->mtx);
+
+    return ret;
+}
+
+//adds a task to the deque of the calling thread, only from a task of aransPoolSteal,
+//the task runs before aransPoolSteal returns, on failure nothing is added and the caller runs it itself
+STORAGE_SPEC int aransPoolSpawn(struct AransPool *pool, AransTask task, void *ctx, size_t i) {
+    if (!poolDeque)
+        return 1;
+
+    atomic_fetch_add(&pool->active, 1);
+
+    if (dequePush(poolDeque, (struct PoolTask) {task, ctx, i})) {
+        atomic_fetch_sub(&pool->active, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+STORAGE_SPEC void aransPoolDestroy(struct AransPool *pool) {
+    pthread_mutex_lock(&pool->mtx);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mtx);
+
+    for (int i = 0; i < pool->count; ++i)
+        pthread_join(pool->workers[i], NULL);
+
+    if (pool->deques)
+        for (int i = 0; i <= pool->count; ++i) {
+            pthread_mutex_destroy(&pool->deques[i].mtx);
+            free(pool->deques[i].tasks);
+        }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mtx);
+    free(pool->deques);
+    free(pool->workers);
+    free(pool->cpus);
+    free(pool);
+}
+
+//frees the scratch buffers of the calling thread
+STORAGE_SPEC void aransScratchFree(void) {
+    for (int i = 0; i < SCRATCH_SLOTS; ++i) {
+        free(poolScratch[i].ptr);
+        poolScratch[i] = (struct PoolScratch) {NULL, 0};
+    }
+}
+
+//internal functions
+
+//takes cpus, count of them, the pool frees them
+static struct AransPool *poolCreate(int threads, int *cpus, int count) {
+    struct AransPool *pool = (struct AransPool *) calloc(1, sizeof(struct AransPool));
+
+    if (!pool) {
+        free(cpus);
+        return NULL;
+    }
+
+    pool->cpus = cpus;
+    pool->cpu_count = count;
+
+    pthread_mutex_init(&pool->mtx, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->deques = (struct PoolDeque *) calloc(threads > 1 ? threads : 1, sizeof(struct PoolDeque));
+
+    if (!pool->deques) {
+        aransPoolDestroy(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < (threads > 1 ? threads : 1); ++i)
+        pthread_mutex_init(&pool->deques[i].mtx, NULL);
+
+    if (threads > 1) {
+        pool->workers = (pthread_t *) malloc((threads - 1) * sizeof(pthread_t));
+
+        if (!pool->workers) {
+            aransPoolDestroy(pool);
+            return NULL;
+        }
+
+        for (int i = 0; i < threads - 1; ++i) {
+            if (pthread_create(&pool->workers[i], NULL, poolWorker, pool))
+                break;
+            ++pool->count;
+        }
+    }
+
+    return pool;
+}
+
+static int poolCpus(int *cpus, int node) {
+#ifdef CPU_SETSIZE
+    cpu_set_t allowed;
+    cpu_set_t local;
+    int count = 0;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+        return 0;
+
+    CPU_ZERO(&local);
+
+    if (node == POOL_ALL_NODES) {
+        local = allowed;
+    } else {
+        //cpulist holds ranges like 0-3,8-11
+        char name[64];
+        unsigned first;
+        unsigned last;
+        snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = node >= 0 ? fopen(name, "r") : NULL;
+
+        if (!file)
+            return 0;
+
+        while (fscanf(file, "%u", &first) == 1) {
+            last = first;
+
+            if ((fgetc(file) == '-') && (fscanf(file, "%u", &last) == 1))
+                fgetc(file);
+
+            for (unsigned cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); ++cpu)
+                CPU_SET(cpu, &local);
+        }
+
+        fclose(file);
+    }
+
+    for (int cpu = 0; (cpu < CPU_SETSIZE) && (count < POOL_CPUS_MAX); ++cpu)
+        if (CPU_ISSET(cpu, &local) && CPU_ISSET(cpu, &allowed))
+            cpus[count++] = cpu;
+
+    return count;
+#else
+    (void) cpus;
+    (void) node;
+    return 0;
+#endif
+}
+
+static int poolPin(int cpu) {
+#ifdef CPU_SETSIZE
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0;
+#else
+    (void) cpu;
+    return 1;
+#endif
+}
+
+//returns the buffer of slot of the calling thread holding at least size bytes aligned to align, NULL on failure,
+//the contents are not kept when it grows
+static void *threadScratch(int slot, size_t size, size_t align) {
+    struct PoolScratch *scratch = &poolScratch[slot];
+
+    if (align < SCRATCH_ALIGN)
+        align = SCRATCH_ALIGN;
+
+    if ((size > scratch->size) || ((uintptr_t) scratch->ptr % align)) {
+        size_t bytes = (size + align - 1) / align * align;
+
+        free(scratch->ptr);
+        scratch->ptr = aligned_alloc(align, bytes ? bytes : align);
+        scratch->size = scratch->ptr ? bytes : 0;
+    }
+
+    return scratch->ptr;
+}
+
+static void *poolWorker(void *arg) {
+    struct AransPool *pool = (struct AransPool *) arg;
+    int self = atomic_fetch_add(&pool->joined, 1);
+    unsigned long seen = 0;
+
+    //pinned before the worker touches its stack and buffers, so they are placed on its node
+    if (pool->cpu_count)
+        poolPin(pool->cpus[self % pool->cpu_count]);
+
+    pthread_mutex_lock(&pool->mtx);
+    for (;;) {
+        while (!pool->stop && (pool->generation == seen))
+            pthread_cond_wait(&pool->start, &pool->mtx);
+
+        if (pool->stop)
+            break;
+
+        seen = pool->generation;
+        int steal = pool->steal;
+        pthread_mutex_unlock(&pool->mtx);
+
+        if (steal)
+            poolSteal(pool, self);
+        else
+            poolDrain(pool);
+
+        pthread_mutex_lock(&pool->mtx);
+        if (!--pool->pending)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mtx);
+
+    aransScratchFree();
+    return NULL;
+}
+
+static void poolDrain(struct AransPool *pool) {
+    for (;;) {
+        size_t i = atomic_fetch_add(&pool->next, 1);
+
+        if (i >= pool->total)
+            break;
+
+        pool->task(pool->ctx, i);
+    }
+}
+
+//runs tasks of the deque of thread self and of the others until no task of the loop is left
+static void poolSteal(struct AransPool *pool, int self) {
+    int deques = pool->count + 1;
+    struct PoolTask task;
+
+    poolDeque = &pool->deques[self];
+
+    for (;;) {
+        int found = !dequePop(&pool->deques[self], &task, 0);
+
+        for (int k = 1; !found && (k < deques); ++k)
+            found = !dequePop(&pool->deques[(self + k) % deques], &task, 1);
+
+        if (found) {
+            task.task(task.ctx, task.i);
+            atomic_fetch_sub(&pool->active, 1);
+        } else if (atomic_load(&pool->active)) {
+            //the tasks left are running and may still spawn more
+            sched_yield();
+        } else {
+            break;
+        }
+    }
+
+    poolDeque = NULL;
+}
+
+static int dequePush(struct PoolDeque *deque, struct PoolTask task) {
+    pthread_mutex_lock(&deque->mtx);
+
+    if (deque->size == deque->capacity) {
+        size_t capacity = deque->capacity ? 2 * deque->capacity : 64;
+        struct PoolTask *tasks = (struct PoolTask *) malloc(capacity * sizeof(struct PoolTask));
+
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->mtx);
+            return 1;
+        }
+
+        for (size_t i = 0; i < deque->size; ++i)
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+
+    deque->tasks[(deque->head + deque->size++) % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->mtx);
+    return 0;
+}
+
+//takes the newest task, or the oldest one when oldest is set
+static int dequePop(struct PoolDeque *deque, struct PoolTask *task, int oldest) {
+    int ret = 1;
+
+    pthread_mutex_lock(&deque->mtx);
+    if (deque->size) {
+        if (oldest) {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        } else {
+            *task = deque->tasks[(deque->head + deque->size - 1) % deque->capacity];
+        }
+
+        --deque->size;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&deque->mtx);
+
+    return ret;
+}
+
+#endif //ARANS_POOL_H
@@ -0,0 +1,102 @@
+#ifndef ARANS_SIMD_H
+#define ARANS_SIMD_H
+
+//vector kernels for the model rows of the multi-level variants: a row of size uint16_t entries, size a power of two
+//from 4 to 64, is updated and searched with AVX2 or SSE2 when the target has them, with a scalar loop otherwise,
+//rows are not padded (the model layout is the layout of snapshots and dictionaries), so the loads are unaligned
+
+//includes
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+//internal function declarations
+static inline void simdUpdate(uint16_t *, const uint16_t *, int, int);
+
+static inline unsigned simdCount(const uint16_t *, uint16_t, int);
+
+//internal functions
+
+//cdf[i] += (mtx[i] - cdf[i]) >> rate for i < size, the 16-bit differences do not overflow as the model keeps every
+//entry within PROB_SIZE of its target, so the result equals ((cdf[i] << rate) + mtx[i] - cdf[i]) >> rate
+static inline void simdUpdate(uint16_t *cdf, const uint16_t *mtx, int size, int rate) {
+#ifdef __SSE2__
+    int i = 0;
+
+#ifdef __AVX2__
+    for (; i + 16 <= size; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) &cdf[i]);
+        __m256i m = _mm256_loadu_si256((const __m256i *) &mtx[i]);
+
+        _mm256_storeu_si256((__m256i *) &cdf[i], _mm256_add_epi16(x, _mm256_srai_epi16(_mm256_sub_epi16(m, x), rate)));
+    }
+#endif
+
+    for (; i + 8 <= size; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) &cdf[i]);
+        __m128i m = _mm_loadu_si128((const __m128i *) &mtx[i]);
+
+        _mm_storeu_si128((__m128i *) &cdf[i], _mm_add_epi16(x, _mm_srai_epi16(_mm_sub_epi16(m, x), rate)));
+    }
+
+    if (i + 4 <= size) {
+        __m128i x = _mm_loadl_epi64((const __m128i *) &cdf[i]);
+        __m128i m = _mm_loadl_epi64((const __m128i *) &mtx[i]);
+
+        _mm_storel_epi64((__m128i *) &cdf[i], _mm_add_epi16(x, _mm_srai_epi16(_mm_sub_epi16(m, x), rate)));
+    }
+#else
+    for (int i = 0; i < size; ++i)
+        cdf[i] = ((cdf[i] << rate) + mtx[i] - cdf[i]) >> rate;
+#endif
+}
+
+//number of cdf[i] <= prb for i < size without branches, entries may exceed 1 << 15, so the compares are unsigned:
+//cdf[i] <= prb when the saturated difference cdf[i] - prb is zero
+static inline unsigned simdCount(const uint16_t *cdf, uint16_t prb, int size) {
+    unsigned count = 0;
+
+#ifdef __SSE2__
+    int i = 0;
+
+#ifdef __AVX2__
+    const __m256i val8 = _mm256_set1_epi16((short) prb);
+
+    for (; i + 16 <= size; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) &cdf[i]);
+        __m256i le = _mm256_cmpeq_epi16(_mm256_subs_epu16(x, val8), _mm256_setzero_si256());
+
+        count += __builtin_popcount((unsigned) _mm256_movemask_epi8(le));
+    }
+#endif
+
+    const __m128i val = _mm_set1_epi16((short) prb);
+
+    for (; i + 8 <= size; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) &cdf[i]);
+        __m128i le = _mm_cmpeq_epi16(_mm_subs_epu16(x, val), _mm_setzero_si128());
+
+        count += __builtin_popcount((unsigned) _mm_movemask_epi8(le));
+    }
+
+    //the upper half of the short load is zero and must not count
+    if (i + 4 <= size) {
+        __m128i x = _mm_loadl_epi64((const __m128i *) &cdf[i]);
+        __m128i le = _mm_cmpeq_epi16(_mm_subs_epu16(x, val), _mm_setzero_si128());
+
+        count += __builtin_popcount((unsigned) _mm_movemask_epi8(le) & 0xFF);
+    }
+
+    //movemask gives two bits per entry
+    return count >> 1;
+#else
+    for (int i = 0; i < size; ++i)
+        count += cdf[i] <= prb;
+
+    return count;
+#endif
+}
+
+#endif //ARANS_SIMD_H
@@ -0,0 +1,2266 @@
+#ifndef ARANS_STREAM_H
+#define ARANS_STREAM_H
+
+//stream container shared by the chunked variants,
+//included at the end of a variant header after encAransChunk/decAransChunk
+
+//layout:
+//frame header, chunk 0 ... chunk n-1, index, index size (4 bytes)
+//frame header: magic "ARNS", version, variant id, RATE_BITS, PROB_BITS, CODE_BITS, log2 CHUNK_SIZE,
+//flags (one byte each after the magic), varint original size, big-endian dictionary id when flagged FRAME_DICT
+//index: varint number of chunks, then varint compressed size, varint symbol count and flags byte for every chunk,
+//followed by the big-endian CRC32C of the decoded chunk bytes when the frame is flagged FRAME_CHECKSUM
+
+//variant ids: 1 - 8 (also 8_SIMD), 2 - 4x4, 3 - 3x5, 4 - 2x6, 5 - 2x3x3, 6 - 2x2x4, 7 - 2x2x2x2
+
+//a chunk flagged CHUNK_RESET starts a segment: the model is reset to the state passed to the coder,
+//so segments are independent of each other and can be coded in parallel
+
+//checksums are computed in the model pass of the encoder and in the output loop of the decoder,
+//a chunk whose decoded bytes do not match its checksum fails the decode
+
+//a chunk flagged CHUNK_STORED holds its bytes as is and leaves the model untouched,
+//it is chosen when a sampled collision entropy estimate is close to 8 bits per byte
+//or when the coded chunk would not be smaller than the raw one
+
+//a stream flagged FRAME_APPEND has its original size as a varint padded to VARINT_MAX_SIZE bytes
+//and ends with a CHUNK_MODEL entry holding the final model, aransAppend codes new chunks after that entry
+//with the model restored from it and rewrites the size in place and the index, the chunks stay where they are
+
+//streams coded from the same model (uniform or the same dictionary) are joined without recoding
+//by copying their chunks and rewriting the frame header and index, the first chunk of every joined stream
+//is flagged CHUNK_RESET, checksums are kept only when all joined streams have them
+
+//an entry flagged CHUNK_MODEL decodes to no bytes and holds the model state before the next chunk,
+//written every checkpoint chunks of a segment so aransDecodeRange and the parallel decoder can start there,
+//the state is coded as 16-bit word deltas against the model passed to the coder:
+//varint run of unchanged words, then zigzag varint delta of the next word, repeated up to the last word
+
+//with options->split a segment is coded in batches of chunks: the model pass of a batch fills the range arrays
+//of its chunks while the backward passes of the batch before it run on the other threads of the pool,
+//the chunks are written in order and a chunk that is stored after its backward pass restores the model before it,
+//so the model pass restarts after it, the stream is the same as the one coded in one pass
+
+//aransEncodeMany codes many inputs into streams of their own on one pool: every input is a task that spawns a task
+//per segment on the deque of its thread (see aransPoolSteal), the last segment of an input to finish writes its
+//stream, so idle threads steal the segments of large inputs and the wall time is not set by the largest one
+
+//a chunk flagged CHUNK_LEVELS holds a substream per level instead of one stream shared by all levels:
+//varint sizes of every substream but the last one, then the substreams from the first level to the last,
+//each level has its own state, so the backward passes of the levels run apart and every level of the decoder
+//refills from its own bytes, options->levels codes chunks so, variants with a single level ignore it
+
+//with options->levels and threads the decoder runs every level of such a chunk as a task of its own:
+//a level decodes LEVEL_STEP symbols into the output and publishes its progress, the level below takes the bits
+//of the levels above from the output to choose its cdf row, so the levels run one behind the other and only
+//touch their own cdfs, segments are then decoded one after another
+
+//bits CHUNK_WAYS of the chunk flags hold log2 of the number of interleaved states per level of a coded chunk:
+//symbol i is coded by state i % ways of every level and all states share the stream, they are flushed so
+//the decoder reads the states of the first level first, from state 0 on, the model stays one and is shared,
+//CHUNK_LEVELS chunks have one state per level,
+//the decoder reads such chunks, the encoder does not write them: the states share the adaptive model, whose update
+//and search stay one symbol after another, so the extra states have not made decoding faster yet
+
+//small messages skip the frame and the index: a varint of the size shifted left by 2 holding the number of state
+//bytes minus 1 in the low bits, the final state in that many big-endian bytes, then the coded bytes,
+//all levels share one state that starts at SMALL_STATE instead of CODE_NORM, so nothing is spent on the initial
+//state and the final one drops its leading zero bytes, the decoder stops renormalizing at the end of the message,
+//a message that would not be smaller coded is stored as is after the varint, the decoder tells it by its size
+
+//aransEncodeBatch codes many messages, each from its own copy of the model, into small messages written one after
+//another: BATCH_LANES of them run side by side, their model passes and backward passes take BATCH_STEP symbols
+//of every message in turn, so the independent state chains overlap, aransDecodeBatch decodes them the same way
+
+//includes
+#include <sched.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arans_crc.h"
+#include "arans_dict.h"
+#include "arans_pool.h"
+
+//constants
+#define FRAME_MAGIC "ARNS"          //first bytes of every stream
+#define FRAME_VERSION 1             //version of the stream layout
+#define FRAME_FIXED_SIZE 11         //number of frame header bytes before the original size
+#define FRAME_MAX_SIZE (FRAME_FIXED_SIZE + VARINT_MAX_SIZE + DICT_ID_SIZE) //max number of frame header bytes
+#define DICT_ID_SIZE 4              //number of bytes for a dictionary id
+#define INDEX_TAIL_SIZE 4           //number of bytes for the index size
+#define VARINT_MAX_SIZE 10          //max number of bytes for a 64-bit varint
+#define INDEX_ENTRY_BOUND (2 * VARINT_MAX_SIZE + 1 + CRC_SIZE) //max number of index bytes per chunk
+
+#define FRAME_CHECKSUM 0x01         //every index entry holds the crc of its chunk
+#define FRAME_DICT 0x02             //the model starts from a dictionary, see arans_dict.h
+#define FRAME_APPEND 0x04           //fixed-width original size and a final model entry, see aransAppend
+#define FRAME_FLAGS (FRAME_CHECKSUM | FRAME_DICT | FRAME_APPEND) //frame flags this build decodes
+
+#define CHUNK_RESET 0x01            //model is reset before the chunk
+#define CHUNK_STORED 0x02           //chunk is stored uncoded
+#define CHUNK_MODEL 0x04            //entry is a model snapshot
+#define CHUNK_LEVELS 0x08           //chunk holds a substream per level
+#define CHUNK_WAYS 0x30             //log2 of the number of interleaved states per level
+#define CHUNK_WAYS_SHIFT 4          //position of CHUNK_WAYS
+#define CHUNK_FLAGS (CHUNK_RESET | CHUNK_STORED | CHUNK_MODEL | CHUNK_LEVELS | CHUNK_WAYS) //flags this build decodes
+
+#define MODEL_WORDS (sizeof(struct Arans) / 2) //number of 16-bit words in a model snapshot
+#define MODEL_BOUND (4 * MODEL_WORDS)         //max number of bytes for a model snapshot
+
+#define SMALL_STATE 1               //initial state of a small message
+#define SMALL_MAX_SIZE CHUNK_SIZE   //max number of bytes of a small message
+
+#ifndef BATCH_LANES
+#define BATCH_LANES 8               //number of messages a batch codes side by side
+#endif
+
+#ifndef BATCH_STEP
+#define BATCH_STEP 16               //number of symbols a message of a batch codes before the next one
+#endif
+
+#ifndef PROBE_STEP
+#define PROBE_STEP 2                //sampling step of the entropy probe
+#endif
+
+#ifndef PROBE_RATIO
+#define PROBE_RATIO 230             //store chunks with collision entropy above log2(PROBE_RATIO) = 7.85 bits
+#endif
+
+#define SPLIT_BATCH(T) (2 * (T))    //number of chunks per batch of a split segment for T threads
+
+#define SCRATCH_CHUNKS 0            //threadScratch slot of the split chunks
+#define SCRATCH_RANGES 1            //threadScratch slot of range arrays
+#define SCRATCH_BYTES 2             //threadScratch slot of coded bytes
+#define SCRATCH_ROUND 3             //threadScratch slot of the split round
+
+#ifndef LEVEL_STEP
+#define LEVEL_STEP 256              //number of symbols a level decodes between publishing its progress
+#endif
+
+//structs
+struct AransFrame {
+    unsigned version;
+    unsigned variant;               //ARANS_VARIANT of the encoder
+    unsigned rate_bits;
+    unsigned prob_bits;
+    unsigned code_bits;
+    unsigned chunk_bits;            //log2 of CHUNK_SIZE
+    unsigned flags;                 //FRAME_* bits
+    uint64_t size;                  //original size
+    uint32_t dict;                  //dictionary id, 0 - none
+    size_t header_size;             //position of the first chunk
+};
+
+struct AransChunk {
+    size_t offset;                  //position of the chunk in the stream
+    size_t size;                    //compressed size of the chunk
+    size_t symbols;                 //number of bytes the chunk decodes to
+    unsigned flags;                 //CHUNK_* bits
+    uint32_t crc;                   //CRC32C of the decoded bytes, FRAME_CHECKSUM streams only
+};
+
+struct AransIndex {
+    struct AransFrame frame;
+    size_t count;
+    struct AransChunk *chunks;
+};
+
+struct AransOptions {
+    size_t segment;                 //number of chunks per independent segment, 0 - one segment
+    int threads;                    //number of threads coding segments
+    struct AransPool *pool;         //pool to run on, NULL - a pool of threads is created per call
+    int checksum;                   //store a crc of every chunk (encoding only)
+    size_t checkpoint;              //store a model snapshot every checkpoint chunks of a segment, 0 - none (encoding only)
+    uint32_t dict;                  //id of the dictionary the model was loaded from, 0 - none
+    int append;                     //end the stream with the final model so aransAppend can extend it (encoding only)
+    int split;                      //run the model pass of a segment ahead of its backward passes, which run on the
+                                    //other threads, segments are coded one after another (encoding only)
+    int levels;                     //code every level of a chunk into its own substream, decoding runs the levels
+                                    //of such chunks on threads of their own
+    int pin;                        //pin the worker threads the coder starts to CPUs of their own
+    int node;                       //NUMA node whose CPUs they are pinned to, POOL_ALL_NODES - any
+};
+
+// Encoder
+
+//public function declarations
+STORAGE_SPEC void aransDefaultOptions(struct AransOptions *);
+
+STORAGE_SPEC size_t aransBound(size_t);
+
+STORAGE_SPEC size_t aransBoundEx(const struct AransOptions *, size_t);
+
+STORAGE_SPEC size_t aransEncode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC size_t
+aransEncodeEx(struct Arans *, const struct AransOptions *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC int
+aransEncodeMany(const struct Arans *, const struct AransOptions *, unsigned char *const *, const size_t *,
+                const unsigned char *const *, const size_t *, size_t, size_t *);
+
+//internal structs
+struct SegmentJob {
+    const unsigned char *in;        //encoder: segment input, decoder: whole stream
+    size_t in_size;
+    unsigned char *out;
+    size_t out_size;
+    struct AransChunk *chunks;
+    size_t count;                   //number of index entries
+    size_t size;                    //result, 0 on failure
+    size_t prior;                   //encoder: chunks of the segment coded before the job, 0 - the job starts it
+};
+
+struct SegmentBatch {
+    const struct Arans *base;       //model every segment starts from
+    const struct Arans *start;      //encoder: model segment 0 starts from
+    struct Arans *model;            //receives the model after segment last
+    size_t last;
+    size_t first;                   //segment number of jobs[0]
+    struct SegmentJob *jobs;
+    int checksum;                   //compute chunk crcs
+    size_t checkpoint;              //chunks between model snapshots
+    struct AransPool *split;        //encoder: pool running the backward passes of the segments,
+                                    //decoder: pool running the levels of CHUNK_LEVELS chunks, NULL - one pass
+    int levels;                     //encoder: code chunks flagged CHUNK_LEVELS
+};
+
+struct ManyInput {
+    struct Arans model;             //model after the last segment
+    const struct Arans *base;       //model every segment starts from
+    const struct AransOptions *options;
+    unsigned char *out;
+    size_t out_size;
+    const unsigned char *in;
+    size_t in_size;
+    size_t *size;                   //receives the stream size, 0 on failure
+    struct AransPool *pool;
+    struct SegmentBatch batch;
+    struct SegmentJob *jobs;
+    unsigned char *scratch;         //output of every segment
+    struct AransChunk *chunks;      //index entries of every segment
+    atomic_size_t left;             //number of segments still coding
+};
+
+struct SplitChunk {
+    struct Arans model;             //model before the chunk
+    const unsigned char *in;
+    size_t symbols;
+    int coded;                      //the model pass ran, the entropy probe did not store the chunk
+    uint32_t crc;
+    struct Range *range;            //RANGE_LEVELS * CHUNK_SIZE ranges of the model pass
+    unsigned char *out;             //CHUNK_SIZE bytes of the backward pass, RANGE_LEVELS * CHUNK_SIZE with levels
+    size_t size;                    //backward pass result, 0 - not smaller than the chunk
+    size_t sizes[RANGE_LEVELS];     //backward pass results of the levels with levels
+};
+
+struct SplitRound {
+    struct Arans model;             //model after the chunks of the model pass
+    struct SplitChunk *coded;       //chunks of the backward passes
+    size_t coded_count;
+    struct SplitChunk *next;        //chunks of the model pass
+    size_t next_count;
+    int checksum;
+    int levels;                     //every level of a coded chunk is a task of its own
+};
+
+//internal function declarations
+static size_t
+encStream(struct Arans *, const struct Arans *, const struct AransOptions *, size_t, unsigned char *, size_t, size_t,
+          const unsigned char *, size_t, struct AransIndex *);
+
+static size_t encFinish(const struct Arans *, const struct Arans *, unsigned char *, size_t, size_t, struct AransIndex *);
+
+static struct AransPool *optionsPool(const struct AransOptions *, int);
+
+static size_t encSegment(struct Arans *, const struct SegmentBatch *, struct SegmentJob *);
+
+static void encSegmentTask(void *, size_t);
+
+static void encManyTask(void *, size_t);
+
+static void encManySegment(void *, size_t);
+
+static void encManyFinish(struct ManyInput *);
+
+static size_t encSplit(struct Arans *, const struct SegmentBatch *, struct SegmentJob *);
+
+static void encSplitTask(void *, size_t);
+
+static size_t encLevelChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *);
+
+static int encProbe(const unsigned char *, size_t);
+
+static size_t encStored(unsigned char *, size_t, const unsigned char *, size_t, uint32_t *, int);
+
+static size_t encSegmentBound(size_t, size_t);
+
+static size_t encSegmentEntries(size_t, size_t, size_t);
+
+static size_t encSegmentModels(size_t, size_t);
+
+static size_t putModel(unsigned char *, size_t, const struct Arans *, const struct Arans *);
+
+static size_t putFrame(unsigned char *, uint64_t, unsigned, uint32_t);
+
+static size_t putIndex(unsigned char *, size_t, const struct AransIndex *);
+
+static size_t levelsSize(const size_t *);
+
+static void putLevels(unsigned char *, const unsigned char *, const size_t *);
+
+static size_t putVarint(unsigned char *, uint64_t);
+
+static size_t putVarintFixed(unsigned char *, uint64_t);
+
+static size_t varintSize(uint64_t);
+
+//public functions
+STORAGE_SPEC void aransDefaultOptions(struct AransOptions *options) {
+    options->segment = 0;
+    options->threads = 1;
+    options->pool = NULL;
+    options->checksum = 0;
+    options->checkpoint = 0;
+    options->dict = 0;
+    options->append = 0;
+    options->split = 0;
+    options->levels = 0;
+    options->pin = 0;
+    options->node = POOL_ALL_NODES;
+}
+
+STORAGE_SPEC size_t aransBound(size_t in_size) {
+    struct AransOptions options;
+    aransDefaultOptions(&options);
+
+    return aransBoundEx(&options, in_size);
+}
+
+STORAGE_SPEC size_t aransBoundEx(const struct AransOptions *options, size_t in_size) {
+    size_t chunks = (in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t models = encSegmentModels(chunks, options->checkpoint);
+
+    //the final model of an appendable stream is one more snapshot
+    if (options->append)
+        ++models;
+
+    return in_size + FRAME_MAX_SIZE + VARINT_MAX_SIZE + INDEX_ENTRY_BOUND * (chunks + models) + MODEL_BOUND * models +
+           INDEX_TAIL_SIZE;
+}
+
+STORAGE_SPEC size_t
+aransEncode(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
+    struct AransOptions options;
+    aransDefaultOptions(&options);
+
+    return aransEncodeEx(arans, &options, out, out_size, in, in_size);
+}
+
+STORAGE_SPEC size_t
+aransEncodeEx(struct Arans *arans, const struct AransOptions *options, unsigned char *out, size_t out_size,
+              const unsigned char *in, size_t in_size) {
+    if (out_size < FRAME_MAX_SIZE)
+        return 0;
+
+    unsigned flags = (options->checksum ? FRAME_CHECKSUM : 0) | (options->dict ? FRAME_DICT : 0) |
+                     (options->append ? FRAME_APPEND : 0);
+    size_t out_pos = putFrame(out, in_size, flags, options->dict);
+
+    struct Arans base = *arans;
+    struct AransIndex index = {{0}, 0, NULL};
+    size_t ret = 0;
+    index.frame.flags = flags;
+
+    out_pos = encStream(arans, &base, options, 0, out, out_size, out_pos, in, in_size, &index);
+
+    if (out_pos)
+        ret = encFinish(arans, &base, out, out_size, out_pos, &index);
+
+    free(index.chunks);
+    return ret;
+}
+
+//codes count inputs into streams of their own like aransEncodeEx, each one from a copy of arans,
+//on options->pool or on options->threads threads, sizes receives the size of every stream, 0 - failed,
+//options->split is left out, the segments of the inputs are the tasks
+STORAGE_SPEC int
+aransEncodeMany(const struct Arans *arans, const struct AransOptions *options, unsigned char *const *outs,
+                const size_t *out_sizes, const unsigned char *const *ins, const size_t *in_sizes, size_t count,
+                size_t *sizes) {
+    struct ManyInput *inputs = (struct ManyInput *) aligned_alloc(alignof(struct ManyInput),
+                                                                  (count + 1) * sizeof(struct ManyInput));
+    struct AransPool *pool = options->pool;
+    int ret = 1;
+
+    if (inputs && (pool || (pool = optionsPool(options, options->threads > 1 ? options->threads : 1)))) {
+        for (size_t i = 0; i < count; ++i) {
+            memset(&inputs[i], 0, sizeof(struct ManyInput));
+            inputs[i].base = arans;
+            inputs[i].options = options;
+            inputs[i].out = outs[i];
+            inputs[i].out_size = out_sizes[i];
+            inputs[i].in = ins[i];
+            inputs[i].in_size = in_sizes[i];
+            inputs[i].size = &sizes[i];
+            inputs[i].pool = pool;
+            sizes[i] = 0;
+        }
+
+        ret = aransPoolSteal(pool, count, encManyTask, inputs);
+
+        for (size_t i = 0; i < count; ++i)
+            ret |= !sizes[i];
+    }
+
+    if (pool && !options->pool)
+        aransPoolDestroy(pool);
+
+    free(inputs);
+    return ret;
+}
+
+//internal functions
+
+//creates a pool of threads for options, pinned with options->pin
+static struct AransPool *optionsPool(const struct AransOptions *options, int threads) {
+    return options->pin ? aransPoolCreatePinned(threads, options->node) : aransPoolCreate(threads);
+}
+
+//codes in as chunks at out_pos and adds them to index, arans holds the model the first segment starts from
+//and receives the final model, base is the model the other segments reset to,
+//prior - number of chunks of the segment coded before in, they are not reset and count for snapshots
+static size_t
+encStream(struct Arans *arans, const struct Arans *base, const struct AransOptions *options, size_t prior,
+          unsigned char *out, size_t out_size, size_t out_pos, const unsigned char *in, size_t in_size,
+          struct AransIndex *index) {
+    size_t chunks = (in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t segment = options->segment && (options->segment < chunks) ? options->segment : chunks;
+    size_t segments = segment ? (chunks + segment - 1) / segment : 0;
+    size_t entries = encSegmentEntries(segment, options->checkpoint, 0);
+    size_t head = encSegmentEntries(segment, options->checkpoint, prior);
+
+    //every segment but the last one is full, only the first one follows prior chunks,
+    //one more entry is kept for the final model
+    size_t count = segments > 1 ? head + (segments - 2) * entries +
+                                  encSegmentEntries(chunks - (segments - 1) * segment, options->checkpoint, 0) : head;
+    struct AransChunk *grown = (struct AransChunk *) realloc(index->chunks,
+                                                             (index->count + count + 1) * sizeof(struct AransChunk));
+
+    if (!grown)
+        return 0;
+
+    index->chunks = grown;
+
+    //a split segment takes all threads, so the segments are coded one after another
+    int split = options->split && (options->threads > 1) && segments;
+    size_t width = (options->threads > 1) && !split ? options->threads : 1;
+    struct AransPool *pool = options->pool;
+
+    if (width > segments)
+        width = segments ? segments : 1;
+
+    if (((width > 1) || split) && !pool && !(pool = optionsPool(options, split ? options->threads : (int) width)))
+        return 0;
+
+    //a single job codes straight into the output, wider rounds go through scratch buffers
+    struct SegmentJob jobs[width];
+    size_t bound = encSegmentBound(segment * CHUNK_SIZE, options->checkpoint);
+    unsigned char *scratch = width > 1 ? (unsigned char *) threadScratch(SCRATCH_BYTES, width * bound, 1) : NULL;
+
+    struct Arans start = *arans;
+    struct SegmentBatch batch = {base, &start, arans, segments - 1, 0, jobs, options->checksum, options->checkpoint,
+                                 split ? pool : NULL, options->levels && (RANGE_LEVELS > 1)};
+
+    if ((width > 1) && !scratch)
+        segments = 0;
+
+    for (size_t first = 0; first < segments; first += width) {
+        size_t round = segments - first < width ? segments - first : width;
+
+        for (size_t j = 0; j < round; ++j) {
+            size_t chunk = (first + j) * segment;
+            size_t in_pos = chunk * CHUNK_SIZE;
+            size_t in_rem = in_size - in_pos;
+
+            jobs[j].in = &in[in_pos];
+            jobs[j].in_size = in_rem < segment * CHUNK_SIZE ? in_rem : segment * CHUNK_SIZE;
+            jobs[j].out = width > 1 ? &scratch[j * bound] : &out[out_pos];
+            jobs[j].out_size = width > 1 ? bound : out_size - out_pos;
+            jobs[j].chunks = &index->chunks[index->count + (first + j ? head + (first + j - 1) * entries : 0)];
+            jobs[j].count = 0;
+            jobs[j].size = 0;
+            jobs[j].prior = first + j ? 0 : prior;
+        }
+
+        batch.first = first;
+
+        if (width > 1)
+            aransPoolRun(pool, round, encSegmentTask, &batch);
+        else
+            encSegmentTask(&batch, 0);
+
+        for (size_t j = 0; j < round; ++j) {
+            size_t size = jobs[j].size;
+
+            if (!size || (size > out_size - out_pos)) {
+                segments = 0;
+                break;
+            }
+
+            if (width > 1)
+                memcpy(&out[out_pos], jobs[j].out, size);
+
+            for (size_t i = 0; i < jobs[j].count; ++i)
+                jobs[j].chunks[i].offset += out_pos;
+
+            out_pos += size;
+        }
+    }
+
+    if (pool && !options->pool)
+        aransPoolDestroy(pool);
+
+    if (!segments && count)
+        return 0;
+
+    index->count += count;
+    return out_pos;
+}
+
+//writes the final model of an appendable stream and the index after the chunks
+static size_t
+encFinish(const struct Arans *arans, const struct Arans *base, unsigned char *out, size_t out_size, size_t out_pos,
+          struct AransIndex *index) {
+    if (index->frame.flags & FRAME_APPEND) {
+        size_t size = putModel(&out[out_pos], out_size - out_pos, arans, base);
+
+        if (!size)
+            return 0;
+
+        index->chunks[index->count++] = (struct AransChunk) {out_pos, size, 0, CHUNK_MODEL, 0};
+        out_pos += size;
+    }
+
+    size_t size = putIndex(&out[out_pos], out_size - out_pos, index);
+
+    if (!size)
+        return 0;
+
+    return out_pos + size;
+}
+
+static size_t encSegment(struct Arans *arans, const struct SegmentBatch *batch, struct SegmentJob *job) {
+    if (batch->split)
+        return encSplit(arans, batch, job);
+
+    unsigned char *out = job->out;
+    size_t out_size = job->out_size;
+    const unsigned char *in = job->in;
+    size_t in_size = job->in_size;
+    struct AransChunk *chunks = job->chunks;
+    int checksum = batch->checksum;
+    size_t out_pos = 0;
+    size_t count = 0;
+
+    //n counts the chunks from the start of the segment
+    for (size_t n = job->prior; in_size; ++n) {
+        if (n && batch->checkpoint && !(n % batch->checkpoint)) {
+            size_t ret = putModel(&out[out_pos], out_size - out_pos, arans, batch->base);
+
+            if (!ret)
+                return 0;
+
+            chunks[count++] = (struct AransChunk) {out_pos, ret, 0, CHUNK_MODEL, 0};
+            out_pos += ret;
+        }
+
+        size_t symbols = in_size < CHUNK_SIZE ? in_size : CHUNK_SIZE;
+        size_t limit = out_size - out_pos < symbols ? out_size - out_pos : symbols;
+        size_t ret = 0;
+        unsigned flags = n ? 0 : CHUNK_RESET;
+        uint32_t crc = CRC_INIT;
+        int coded = 0;
+
+        if (!encProbe(in, symbols)) {
+            struct Arans saved = *arans;
+            if (batch->levels)
+                ret = encLevelChunk(arans, &out[out_pos], limit, in, symbols, checksum ? &crc : NULL);
+            else
+                ret = encAransChunk(arans, &out[out_pos], limit, in, symbols, checksum ? &crc : NULL);
+
+            coded = 1;
+
+            if (!ret || (ret >= symbols)) {
+                *arans = saved;
+                ret = 0;
+            }
+        }
+
+        if (!ret) {
+            ret = encStored(&out[out_pos], limit, in, symbols, checksum ? &crc : NULL, coded);
+
+            if (!ret)
+                return 0;
+
+            flags |= CHUNK_STORED;
+        } else if (batch->levels) {
+            flags |= CHUNK_LEVELS;
+        }
+
+        chunks[count++] = (struct AransChunk) {out_pos, ret, symbols, flags, ~crc};
+        out_pos += ret;
+        in = &in[symbols];
+        in_size -= symbols;
+    }
+
+    job->count = count;
+    return out_pos;
+}
+
+static void encSegmentTask(void *ctx, size_t i) {
+    struct SegmentBatch *batch = (struct SegmentBatch *) ctx;
+    struct SegmentJob *job = &batch->jobs[i];
+    struct Arans model = batch->first + i ? *batch->base : *batch->start;
+
+    job->size = encSegment(&model, batch, job);
+
+    if (batch->first + i == batch->last)
+        *batch->model = model;
+}
+
+//starts input i of aransEncodeMany: spawns a task for every segment, the last one writes the stream
+static void encManyTask(void *ctx, size_t i) {
+    struct ManyInput *input = &((struct ManyInput *) ctx)[i];
+    const struct AransOptions *options = input->options;
+    size_t chunks = (input->in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t segment = options->segment && (options->segment < chunks) ? options->segment : chunks;
+    size_t segments = segment ? (chunks + segment - 1) / segment : 0;
+    size_t entries = encSegmentEntries(segment, options->checkpoint, 0);
+    size_t bound = encSegmentBound(segment * CHUNK_SIZE, options->checkpoint);
+
+    input->model = *input->base;
+    input->batch = (struct SegmentBatch) {input->base, input->base, &input->model, segments - 1, 0, NULL,
+                                          options->checksum, options->checkpoint, NULL,
+                                          options->levels && (RANGE_LEVELS > 1)};
+
+    if (!segments) {
+        encManyFinish(input);
+        return;
+    }
+
+    input->jobs = (struct SegmentJob *) malloc(segments * sizeof(struct SegmentJob));
+    input->scratch = (unsigned char *) malloc(segments * bound);
+    input->chunks = (struct AransChunk *) malloc((segments * entries + 1) * sizeof(struct AransChunk));
+
+    if (!input->jobs || !input->scratch || !input->chunks) {
+        free(input->jobs);
+        free(input->scratch);
+        free(input->chunks);
+        return;
+    }
+
+    input->batch.jobs = input->jobs;
+    atomic_store(&input->left, segments);
+
+    for (size_t j = 0; j < segments; ++j) {
+        size_t in_pos = j * segment * CHUNK_SIZE;
+        size_t in_rem = input->in_size - in_pos;
+        size_t in_size = in_rem < segment * CHUNK_SIZE ? in_rem : segment * CHUNK_SIZE;
+
+        input->jobs[j] = (struct SegmentJob) {&input->in[in_pos], in_size, &input->scratch[j * bound], bound,
+                                              &input->chunks[j * entries], 0, 0, 0};
+    }
+
+    //the thread that spawned them takes the newest task first, so the last segment is spawned first
+    for (size_t j = segments; j > 0; --j)
+        if (aransPoolSpawn(input->pool, encManySegment, input, j - 1))
+            encManySegment(input, j - 1);
+}
+
+static void encManySegment(void *ctx, size_t i) {
+    struct ManyInput *input = (struct ManyInput *) ctx;
+
+    encSegmentTask(&input->batch, i);
+
+    if (atomic_fetch_sub(&input->left, 1) == 1)
+        encManyFinish(input);
+}
+
+//writes the stream of input after its segments are coded, the way aransEncodeEx does
+static void encManyFinish(struct ManyInput *input) {
+    const struct AransOptions *options = input->options;
+    unsigned flags = (options->checksum ? FRAME_CHECKSUM : 0) | (options->dict ? FRAME_DICT : 0) |
+                     (options->append ? FRAME_APPEND : 0);
+    struct AransIndex index = {{0}, 0, NULL};
+    size_t segments = input->batch.last + 1;
+    size_t out_pos = 0;
+
+    index.frame.flags = flags;
+    index.chunks = input->chunks;
+
+    if (input->out_size >= FRAME_MAX_SIZE)
+        out_pos = putFrame(input->out, input->in_size, flags, options->dict);
+
+    //the entries of every segment are moved down behind the ones of the segments before it
+    for (size_t j = 0; out_pos && (j < segments) && input->jobs; ++j) {
+        struct SegmentJob *job = &input->jobs[j];
+
+        if (!job->size || (job->size > input->out_size - out_pos)) {
+            out_pos = 0;
+            break;
+        }
+
+        memcpy(&input->out[out_pos], job->out, job->size);
+
+        for (size_t k = 0; k < job->count; ++k) {
+            index.chunks[index.count] = job->chunks[k];
+            index.chunks[index.count++].offset += out_pos;
+        }
+
+        out_pos += job->size;
+    }
+
+    //an empty input has no segments, the index keeps room for the final model
+    if (out_pos && !input->jobs && !(index.chunks = (struct AransChunk *) malloc(sizeof(struct AransChunk))))
+        out_pos = 0;
+
+    if (out_pos)
+        *input->size = encFinish(&input->model, input->base, input->out, input->out_size, out_pos, &index);
+
+    free(input->jobs);
+    free(input->scratch);
+    free(index.chunks);
+}
+
+//codes the segment of job like encSegment with the backward passes of every batch on batch->split
+//while the model pass of the next batch runs
+static size_t encSplit(struct Arans *arans, const struct SegmentBatch *batch, struct SegmentJob *job) {
+    size_t width = SPLIT_BATCH(batch->split->count + 1);
+    struct SplitChunk *chunks = (struct SplitChunk *) threadScratch(SCRATCH_CHUNKS, 2 * width * sizeof(struct SplitChunk),
+                                                                    alignof(struct SplitChunk));
+    struct Range *ranges = (struct Range *) threadScratch(SCRATCH_RANGES, 2 * width * RANGE_LEVELS * CHUNK_SIZE *
+                                                                          sizeof(struct Range), alignof(struct Range));
+    size_t levels = batch->levels ? RANGE_LEVELS : 1;
+    unsigned char *scratch = (unsigned char *) threadScratch(SCRATCH_BYTES, 2 * width * levels * CHUNK_SIZE, 1);
+    struct SplitRound *round = (struct SplitRound *) threadScratch(SCRATCH_ROUND, sizeof(struct SplitRound),
+                                                                   alignof(struct SplitRound));
+
+    if (!chunks || !ranges || !scratch || !round)
+        return 0;
+
+    for (size_t i = 0; i < 2 * width; ++i) {
+        chunks[i].range = &ranges[i * RANGE_LEVELS * CHUNK_SIZE];
+        chunks[i].out = &scratch[i * levels * CHUNK_SIZE];
+    }
+
+    round->model = *arans;
+    round->coded = chunks;
+    round->coded_count = 0;
+    round->next = &chunks[width];
+    round->checksum = batch->checksum;
+    round->levels = batch->levels;
+
+    unsigned char *out = job->out;
+    size_t out_size = job->out_size;
+    struct AransChunk *entries = job->chunks;
+    size_t in_pos = 0;              //input position of the next model pass
+    size_t out_pos = 0;
+    size_t count = 0;
+    size_t n = job->prior;          //counts the chunks from the start of the segment
+    int failed = 0;
+
+    while (!failed && (round->coded_count || (in_pos < job->in_size))) {
+        for (round->next_count = 0; (round->next_count < width) && (in_pos < job->in_size); ++round->next_count) {
+            struct SplitChunk *chunk = &round->next[round->next_count];
+            size_t in_rem = job->in_size - in_pos;
+
+            chunk->in = &job->in[in_pos];
+            chunk->symbols = in_rem < CHUNK_SIZE ? in_rem : CHUNK_SIZE;
+            in_pos += chunk->symbols;
+        }
+
+        aransPoolRun(batch->split, 1 + round->coded_count * levels, encSplitTask, round);
+
+        for (size_t i = 0; !failed && (i < round->coded_count); ++i, ++n) {
+            struct SplitChunk *chunk = &round->coded[i];
+            size_t symbols = chunk->symbols;
+            size_t ret = !chunk->coded ? 0 : batch->levels ? levelsSize(chunk->sizes) : chunk->size;
+            unsigned flags = n ? 0 : CHUNK_RESET;
+
+            if (n && batch->checkpoint && !(n % batch->checkpoint)) {
+                size_t size = putModel(&out[out_pos], out_size - out_pos, &chunk->model, batch->base);
+
+                if (!size) {
+                    failed = 1;
+                    break;
+                }
+
+                entries[count++] = (struct AransChunk) {out_pos, size, 0, CHUNK_MODEL, 0};
+                out_pos += size;
+            }
+
+            if (ret >= symbols || (ret > out_size - out_pos))
+                ret = 0;
+
+            if (ret && batch->levels) {
+                putLevels(&out[out_pos], chunk->out, chunk->sizes);
+                flags |= CHUNK_LEVELS;
+            } else if (ret) {
+                memcpy(&out[out_pos], chunk->out, ret);
+            } else {
+                ret = encStored(&out[out_pos], out_size - out_pos, chunk->in, symbols,
+                                batch->checksum ? &chunk->crc : NULL, chunk->coded);
+
+                if (!ret) {
+                    failed = 1;
+                    break;
+                }
+
+                flags |= CHUNK_STORED;
+
+                //a rejected chunk leaves the model as it was, the model pass went on from the changed one
+                if (chunk->coded) {
+                    round->model = chunk->model;
+                    round->next_count = 0;
+                    in_pos = chunk->in + symbols - job->in;
+                    round->coded_count = i + 1;
+                }
+            }
+
+            entries[count++] = (struct AransChunk) {out_pos, ret, symbols, flags, ~chunk->crc};
+            out_pos += ret;
+        }
+
+        struct SplitChunk *coded = round->coded;
+        round->coded = round->next;
+        round->coded_count = round->next_count;
+        round->next = coded;
+    }
+
+    *arans = round->model;
+    job->count = count;
+
+    return failed ? 0 : out_pos;
+}
+
+//task 0 is the model pass of the next batch, the other tasks are the backward passes of the coded batch,
+//one per chunk or with levels one per level of every chunk
+static void encSplitTask(void *ctx, size_t i) {
+    struct SplitRound *round = (struct SplitRound *) ctx;
+
+    if (i && round->levels) {
+        struct SplitChunk *chunk = &round->coded[(i - 1) / RANGE_LEVELS];
+        size_t level = (i - 1) % RANGE_LEVELS;
+
+        if (chunk->coded)
+            chunk->sizes[level] = encAransLevel(&chunk->range[level * CHUNK_SIZE], &chunk->out[level * CHUNK_SIZE],
+                                                chunk->symbols, chunk->symbols);
+
+        return;
+    }
+
+    if (i) {
+        struct SplitChunk *chunk = &round->coded[i - 1];
+
+        if (chunk->coded)
+            chunk->size = encAransRanges(chunk->range, chunk->out, chunk->symbols, chunk->symbols);
+
+        return;
+    }
+
+    for (size_t j = 0; j < round->next_count; ++j) {
+        struct SplitChunk *chunk = &round->next[j];
+
+        chunk->model = round->model;
+        chunk->crc = CRC_INIT;
+        chunk->coded = !encProbe(chunk->in, chunk->symbols);
+
+        if (chunk->coded)
+            encAransModel(&round->model, chunk->range, chunk->in, chunk->symbols, round->checksum ? &chunk->crc : NULL);
+    }
+}
+
+//codes a chunk like encAransChunk with every level in a substream of its own, see CHUNK_LEVELS,
+//returns 0 when the substreams do not fit in out_size bytes
+static size_t
+encLevelChunk(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc) {
+    struct Range range[RANGE_LEVELS * CHUNK_SIZE];
+    unsigned char sub[RANGE_LEVELS * CHUNK_SIZE];
+    size_t sizes[RANGE_LEVELS];
+
+    encAransModel(arans, range, in, in_size, crc);
+
+    for (size_t level = 0; level < RANGE_LEVELS; ++level)
+        sizes[level] = encAransLevel(&range[level * CHUNK_SIZE], &sub[level * CHUNK_SIZE], in_size, in_size);
+
+    size_t size = levelsSize(sizes);
+
+    if (!size || (size > out_size))
+        return 0;
+
+    putLevels(out, sub, sizes);
+    return size;
+}
+
+static int encProbe(const unsigned char *in, size_t in_size) {
+    uint32_t freq[256] = {0};
+    uint64_t sum = 0;
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < in_size; i += PROBE_STEP, ++count)
+        ++freq[in[i]];
+
+    for (int i = 0; i < 256; ++i)
+        sum += (uint64_t) freq[i] * freq[i];
+
+    //collision entropy -log2(sum / count^2) is a lower bound of the order-0 entropy
+    return sum * PROBE_RATIO <= count * count;
+}
+
+//stores symbols bytes of in uncoded in out of out_size bytes, updates crc unless NULL, 0 - out is too small
+static size_t encStored(unsigned char *out, size_t out_size, const unsigned char *in, size_t symbols, uint32_t *crc,
+                        int coded) {
+    if (out_size < symbols)
+        return 0;
+
+    memcpy(out, in, symbols);
+
+    //the model pass has already hashed a chunk that was coded and then rejected
+    if (crc && !coded)
+        *crc = crcBlock(*crc, in, symbols);
+
+    return symbols;
+}
+
+static size_t encSegmentBound(size_t in_size, size_t checkpoint) {
+    size_t chunks = (in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    //a chunk never takes more bytes than it decodes to
+    return in_size + MODEL_BOUND * encSegmentModels(chunks, checkpoint);
+}
+
+//number of entries of chunks chunks that follow prior chunks of their segment
+static size_t encSegmentEntries(size_t chunks, size_t checkpoint, size_t prior) {
+    //a snapshot precedes every checkpoint-th chunk of the segment but the first one
+    if (!chunks || !checkpoint)
+        return chunks;
+
+    return chunks + (prior + chunks - 1) / checkpoint - (prior ? (prior - 1) / checkpoint : 0);
+}
+
+//max number of snapshots among chunks chunks in a row of a segment
+static size_t encSegmentModels(size_t chunks, size_t checkpoint) {
+    return checkpoint ? (chunks + checkpoint - 1) / checkpoint : 0;
+}
+
+static size_t putModel(unsigned char *out, size_t out_size, const struct Arans *model, const struct Arans *base) {
+    uint16_t cur[MODEL_WORDS];
+    uint16_t ref[MODEL_WORDS];
+    unsigned char *ptr = out;
+    size_t run = 0;
+
+    if (out_size < MODEL_BOUND)
+        return 0;
+
+    memcpy(cur, model, sizeof(cur));
+    memcpy(ref, base, sizeof(ref));
+
+    for (size_t i = 0; i < MODEL_WORDS; ++i) {
+        int16_t delta = (int16_t) (cur[i] - ref[i]);
+
+        if (!delta) {
+            ++run;
+            continue;
+        }
+
+        ptr += putVarint(ptr, run);
+        ptr += putVarint(ptr, ((uint32_t) delta << 1 ^ (uint32_t) (delta >> 15)) & 0xFFFF);
+        run = 0;
+    }
+
+    if (run)
+        ptr += putVarint(ptr, run);
+
+    return ptr - out;
+}
+
+static size_t putFrame(unsigned char *out, uint64_t in_size, unsigned flags, uint32_t dict) {
+    size_t chunk_bits = 0;
+
+    while (((size_t) 1 << chunk_bits) < CHUNK_SIZE)
+        ++chunk_bits;
+
+    memcpy(out, FRAME_MAGIC, 4);
+    out[4] = FRAME_VERSION;
+    out[5] = ARANS_VARIANT;
+    out[6] = RATE_BITS;
+    out[7] = PROB_BITS;
+    out[8] = CODE_BITS;
+    out[9] = chunk_bits;
+    out[10] = flags;
+
+    unsigned char *ptr = &out[FRAME_FIXED_SIZE];
+    ptr += flags & FRAME_APPEND ? putVarintFixed(ptr, in_size) : putVarint(ptr, in_size);
+
+    if (flags & FRAME_DICT) {
+        *ptr++ = dict >> 24;
+        *ptr++ = dict >> 16;
+        *ptr++ = dict >> 8;
+        *ptr++ = dict;
+    }
+
+    return ptr - out;
+}
+
+static size_t putIndex(unsigned char *out, size_t out_size, const struct AransIndex *index) {
+    size_t entry_size = index->frame.flags & FRAME_CHECKSUM ? 1 + CRC_SIZE : 1;
+    size_t size = varintSize(index->count) + entry_size * index->count + INDEX_TAIL_SIZE;
+
+    for (size_t i = 0; i < index->count; ++i)
+        size += varintSize(index->chunks[i].size) + varintSize(index->chunks[i].symbols);
+
+    if (out_size < size)
+        return 0;
+
+    unsigned char *ptr = out;
+    ptr += putVarint(ptr, index->count);
+
+    for (size_t i = 0; i < index->count; ++i) {
+        ptr += putVarint(ptr, index->chunks[i].size);
+        ptr += putVarint(ptr, index->chunks[i].symbols);
+        *ptr++ = index->chunks[i].flags;
+
+        if (index->frame.flags & FRAME_CHECKSUM) {
+            uint32_t crc = index->chunks[i].crc;
+            *ptr++ = crc >> 24;
+            *ptr++ = crc >> 16;
+            *ptr++ = crc >> 8;
+            *ptr++ = crc;
+        }
+    }
+
+    size = ptr - out;
+    *ptr++ = size >> 24;
+    *ptr++ = size >> 16;
+    *ptr++ = size >> 8;
+    *ptr++ = size;
+
+    return ptr - out;
+}
+
+//number of bytes of a CHUNK_LEVELS chunk with substreams of sizes bytes, 0 if a level failed
+static size_t levelsSize(const size_t *sizes) {
+    size_t size = sizes[RANGE_LEVELS - 1];
+
+    for (size_t level = 0; level + 1 < RANGE_LEVELS; ++level)
+        size += varintSize(sizes[level]) + sizes[level];
+
+    for (size_t level = 0; level < RANGE_LEVELS; ++level)
+        if (!sizes[level])
+            return 0;
+
+    return size;
+}
+
+//writes a CHUNK_LEVELS chunk, the substream of a level starts at sub[level * CHUNK_SIZE]
+static void putLevels(unsigned char *out, const unsigned char *sub, const size_t *sizes) {
+    for (size_t level = 0; level + 1 < RANGE_LEVELS; ++level)
+        out += putVarint(out, sizes[level]);
+
+    for (size_t level = 0; level < RANGE_LEVELS; ++level) {
+        memcpy(out, &sub[level * CHUNK_SIZE], sizes[level]);
+        out += sizes[level];
+    }
+}
+
+static size_t putVarintFixed(unsigned char *out, uint64_t val) {
+    for (int i = 0; i < VARINT_MAX_SIZE - 1; ++i) {
+        out[i] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+
+    out[VARINT_MAX_SIZE - 1] = val;
+    return VARINT_MAX_SIZE;
+}
+
+static size_t varintSize(uint64_t val) {
+    size_t size = 1;
+
+    while (val >= 0x80) {
+        val >>= 7;
+        ++size;
+    }
+
+    return size;
+}
+
+static size_t putVarint(unsigned char *out, uint64_t val) {
+    size_t size = 0;
+
+    while (val >= 0x80) {
+        out[size++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+
+    out[size++] = val;
+    return size;
+}
+
+// Encoder
+
+
+// Decoder
+
+// public function declarations
+STORAGE_SPEC size_t aransDecode(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC size_t
+aransDecodeEx(struct Arans *, const struct AransOptions *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC int aransDecodePair(struct Arans *, const struct AransOptions *, unsigned char *const *, const size_t *,
+                                 const unsigned char *const *, const size_t *);
+
+STORAGE_SPEC size_t
+aransDecodeRange(struct Arans *, uint32_t, unsigned char *, const unsigned char *, size_t, uint64_t, size_t);
+
+STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *);
+
+STORAGE_SPEC int aransReadFrame(struct AransFrame *, const unsigned char *, size_t);
+
+STORAGE_SPEC int aransCheckFrame(const struct AransFrame *);
+
+STORAGE_SPEC int aransReadIndex(struct AransIndex *, const unsigned char *, size_t);
+
+STORAGE_SPEC void aransFreeIndex(struct AransIndex *);
+
+// internal structs
+struct LevelChunk {
+    struct Arans *model;
+    unsigned char *out;
+    size_t out_size;
+    const unsigned char *in;        //substream of the first level, the others follow it
+    size_t sizes[RANGE_LEVELS];
+    atomic_size_t done[RANGE_LEVELS]; //number of symbols every level has decoded
+    atomic_int failed;
+};
+
+// internal function declarations
+static void decSegmentTask(void *, size_t);
+
+static void decSegmentPair(struct SegmentBatch *, size_t);
+
+static int
+decJobPair(struct SegmentJob *, const struct Arans *const *, struct Arans *, const int *, struct AransPool *);
+
+static int decPairChunks(struct Arans *, const struct Arans *const *, unsigned char **, const struct SegmentJob *,
+                         const struct AransChunk **, const int *);
+
+static int decEntry(struct Arans *, const struct Arans *, unsigned char *, const unsigned char *, const struct AransChunk *,
+                    int, struct AransPool *);
+
+static int
+decLevelChunk(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t, uint32_t *, struct AransPool *);
+
+static void decLevelTask(void *, size_t);
+
+static int getModel(struct Arans *, const struct Arans *, const unsigned char *, size_t);
+
+static int getIndex(struct AransIndex *, const unsigned char *, size_t, const unsigned char *, size_t, size_t);
+
+static int getVarint(uint64_t *, const unsigned char **, const unsigned char *);
+
+// public functions
+STORAGE_SPEC size_t aransDecode(struct Arans *arans, unsigned char *out, const size_t out_size, const unsigned char *in,
+                                const size_t in_size) {
+    struct AransOptions options;
+    aransDefaultOptions(&options);
+
+    return aransDecodeEx(arans, &options, out, out_size, in, in_size);
+}
+
+STORAGE_SPEC size_t
+aransDecodeEx(struct Arans *arans, const struct AransOptions *options, unsigned char *out, const size_t out_size,
+              const unsigned char *in, const size_t in_size) {
+    struct AransIndex index;
+    size_t out_pos = 0;
+    size_t segments = 0;
+
+    if (aransReadIndex(&index, in, in_size))
+        return 0;
+
+    //model snapshots split segments as well
+    for (size_t i = 0; i < index.count; ++i) {
+        segments += !i || (index.chunks[i].flags & (CHUNK_RESET | CHUNK_MODEL));
+        out_pos += index.chunks[i].symbols;
+    }
+
+    struct SegmentJob *jobs = (struct SegmentJob *) malloc(segments * sizeof(struct SegmentJob) + 1);
+
+    //the model must start from the dictionary the stream was coded with
+    if (!jobs || (out_pos > out_size) || (out_pos != index.frame.size) || (index.frame.dict != options->dict)) {
+        free(jobs);
+        aransFreeIndex(&index);
+        return 0;
+    }
+
+    out_pos = 0;
+
+    for (size_t i = 0, j = 0; i < index.count; ++i) {
+        if (!i || (index.chunks[i].flags & (CHUNK_RESET | CHUNK_MODEL))) {
+            jobs[j++] = (struct SegmentJob) {in, in_size, &out[out_pos], 0, &index.chunks[i], 0, 0, 0};
+        }
+
+        jobs[j - 1].count++;
+        out_pos += index.chunks[i].symbols;
+    }
+
+    //the levels of a chunk take all threads, so the segments are decoded one after another
+    int split = options->levels && (RANGE_LEVELS > 1) && (options->threads > 1);
+    int threads = split || (options->threads < (int) segments) ? options->threads : (int) segments;
+    struct AransPool *pool = options->pool;
+
+    if ((threads > 1) && !pool)
+        pool = optionsPool(options, threads);
+
+    struct Arans base = *arans;
+    struct SegmentBatch batch = {&base, &base, arans, segments - 1, 0, jobs, index.frame.flags & FRAME_CHECKSUM, 0,
+                                 split ? pool : NULL, 0};
+
+    if ((threads > 1) && pool && !split) {
+        aransPoolRun(pool, segments, decSegmentTask, &batch);
+    } else {
+        //one thread decodes the segments two at a time, an odd last one alone
+        for (size_t j = 0; j < segments; j += 2) {
+            if (j + 1 < segments)
+                decSegmentPair(&batch, j);
+            else
+                decSegmentTask(&batch, j);
+        }
+    }
+
+    if (pool && !options->pool)
+        aransPoolDestroy(pool);
+
+    size_t ret = in_size;
+
+    for (size_t j = 0; j < segments; ++j)
+        if (!jobs[j].size)
+            ret = 0;
+
+    free(jobs);
+    aransFreeIndex(&index);
+    return ret;
+}
+
+//decodes two independent streams on one thread like aransDecodeEx decodes two segments of one stream, arans[k] holds
+//the model stream k was coded from and receives its final model, both frames must have the dictionary of options,
+//the threads of options are not used, 0 - both streams decoded into outs
+STORAGE_SPEC int
+aransDecodePair(struct Arans *arans, const struct AransOptions *options, unsigned char *const *outs,
+                const size_t *out_sizes, const unsigned char *const *ins, const size_t *in_sizes) {
+    struct AransIndex index[2];
+    struct SegmentJob jobs[2];
+    int checksums[2];
+
+    if (aransReadIndex(&index[0], ins[0], in_sizes[0]))
+        return 1;
+
+    if (aransReadIndex(&index[1], ins[1], in_sizes[1])) {
+        aransFreeIndex(&index[0]);
+        return 1;
+    }
+
+    int ret = 0;
+
+    for (int k = 0; k < 2; ++k) {
+        uint64_t size = 0;
+
+        for (size_t i = 0; i < index[k].count; ++i)
+            size += index[k].chunks[i].symbols;
+
+        //the models must start from the dictionary the streams were coded with
+        if ((size > out_sizes[k]) || (size != index[k].frame.size) || (index[k].frame.dict != options->dict))
+            ret = 1;
+
+        //a whole stream is one job, its resets and snapshots are entries like the others
+        jobs[k] = (struct SegmentJob) {ins[k], in_sizes[k], outs[k], out_sizes[k], index[k].chunks, index[k].count, 0,
+                                       0};
+        checksums[k] = index[k].frame.flags & FRAME_CHECKSUM;
+    }
+
+    struct Arans base[2] = {arans[0], arans[1]};
+    const struct Arans *bases[2] = {&base[0], &base[1]};
+
+    if (!ret)
+        ret = decJobPair(jobs, bases, arans, checksums, NULL);
+
+    aransFreeIndex(&index[0]);
+    aransFreeIndex(&index[1]);
+    return ret;
+}
+
+//decodes length bytes at offset of the original data into out, starting from the nearest model snapshot
+//or segment start before offset, arans holds the model passed to the encoder (the uniform model
+//or the dictionary of the frame) and is left unchanged, dict is its dictionary id like in AransOptions
+STORAGE_SPEC size_t
+aransDecodeRange(struct Arans *arans, uint32_t dict, unsigned char *out, const unsigned char *in, size_t in_size,
+                 uint64_t offset, size_t length) {
+    struct AransIndex index;
+
+    if (aransReadIndex(&index, in, in_size))
+        return 0;
+
+    //the model must start from the dictionary the stream was coded with
+    if (!length || (offset > index.frame.size) || (length > index.frame.size - offset) || (index.frame.dict != dict)) {
+        aransFreeIndex(&index);
+        return 0;
+    }
+
+    size_t start = 0;
+    uint64_t pos = 0;
+    uint64_t start_pos = 0;
+
+    for (size_t i = 0; (i < index.count) && (pos + index.chunks[i].symbols <= offset); ++i) {
+        pos += index.chunks[i].symbols;
+
+        if ((i + 1 < index.count) && (index.chunks[i + 1].flags & (CHUNK_RESET | CHUNK_MODEL))) {
+            start = i + 1;
+            start_pos = pos;
+        }
+    }
+
+    struct Arans model = *arans;
+    unsigned char buf[CHUNK_SIZE];
+    int checksum = index.frame.flags & FRAME_CHECKSUM;
+    size_t ret = length;
+
+    pos = start_pos;
+
+    for (size_t i = start; (i < index.count) && (pos < offset + length); ++i) {
+        const struct AransChunk *chunk = &index.chunks[i];
+
+        if ((chunk->symbols > CHUNK_SIZE) || decEntry(&model, arans, buf, in, chunk, checksum, NULL)) {
+            ret = 0;
+            break;
+        }
+
+        uint64_t first = pos > offset ? pos : offset;
+        uint64_t last = pos + chunk->symbols < offset + length ? pos + chunk->symbols : offset + length;
+
+        if (first < last)
+            memcpy(&out[first - offset], &buf[first - pos], last - first);
+
+        pos += chunk->symbols;
+    }
+
+    //an index whose symbols end before the range leaves the tail of out unwritten
+    if (pos < offset + length)
+        ret = 0;
+
+    aransFreeIndex(&index);
+    return ret;
+}
+
+STORAGE_SPEC size_t aransGetOutFileSize(unsigned char *in) {
+    struct AransFrame frame;
+
+    if (aransReadFrame(&frame, in, FRAME_MAX_SIZE) || (frame.size > SIZE_MAX))
+        return 0;
+
+    return frame.size;
+}
+
+STORAGE_SPEC int aransReadFrame(struct AransFrame *frame, const unsigned char *in, size_t in_size) {
+    if ((in_size < FRAME_FIXED_SIZE + 1) || memcmp(in, FRAME_MAGIC, 4))
+        return 1;
+
+    frame->version = in[4];
+    frame->variant = in[5];
+    frame->rate_bits = in[6];
+    frame->prob_bits = in[7];
+    frame->code_bits = in[8];
+    frame->chunk_bits = in[9];
+    frame->flags = in[10];
+
+    const unsigned char *ptr = &in[FRAME_FIXED_SIZE];
+    const unsigned char *lim = in_size < FRAME_MAX_SIZE ? &in[in_size] : &in[FRAME_MAX_SIZE];
+
+    if (getVarint(&frame->size, &ptr, lim))
+        return 1;
+
+    frame->dict = 0;
+
+    if (frame->flags & FRAME_DICT) {
+        if (lim - ptr < DICT_ID_SIZE)
+            return 1;
+
+        frame->dict = (uint32_t) ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3];
+        ptr += DICT_ID_SIZE;
+    }
+
+    frame->header_size = ptr - in;
+    return 0;
+}
+
+STORAGE_SPEC int aransCheckFrame(const struct AransFrame *frame) {
+    struct AransFrame own;
+    unsigned char buf[FRAME_MAX_SIZE];
+
+    putFrame(buf, 0, 0, 0);
+    aransReadFrame(&own, buf, sizeof(buf));
+
+    return (frame->version != own.version) || (frame->variant != own.variant) ||
+           (frame->rate_bits != own.rate_bits) || (frame->prob_bits != own.prob_bits) ||
+           (frame->code_bits != own.code_bits) || (frame->chunk_bits != own.chunk_bits) ||
+           (frame->flags & ~FRAME_FLAGS);
+}
+
+STORAGE_SPEC int aransReadIndex(struct AransIndex *index, const unsigned char *in, size_t in_size) {
+    return getIndex(index, in, in_size, in, in_size, in_size);
+}
+
+STORAGE_SPEC void aransFreeIndex(struct AransIndex *index) {
+    free(index->chunks);
+    index->chunks = NULL;
+    index->count = 0;
+}
+
+// internal functions
+static void decSegmentTask(void *ctx, size_t i) {
+    struct SegmentBatch *batch = (struct SegmentBatch *) ctx;
+    struct SegmentJob *job = &batch->jobs[i];
+    struct Arans model = *batch->base;
+    size_t out_pos = 0;
+    size_t size = 0;
+
+    for (size_t c = 0; c < job->count; ++c) {
+        const struct AransChunk *chunk = &job->chunks[c];
+
+        if (decEntry(&model, batch->base, &job->out[out_pos], job->in, chunk, batch->checksum, batch->split))
+            return;
+
+        out_pos += chunk->symbols;
+        size += chunk->size;
+    }
+
+    job->size = size;
+
+    if (i == batch->last)
+        *batch->model = model;
+}
+
+//decodes segments i and i + 1 on one thread with decJobPair
+static void decSegmentPair(struct SegmentBatch *batch, size_t i) {
+    const struct Arans *bases[2] = {batch->base, batch->base};
+    struct Arans models[2] = {*batch->base, *batch->base};
+    int checksums[2] = {batch->checksum, batch->checksum};
+
+    if (decJobPair(&batch->jobs[i], bases, models, checksums, batch->split))
+        return;
+
+    if (i + 1 == batch->last)
+        *batch->model = models[1];
+}
+
+//decodes the entries of two jobs on one thread from models, which receive the final models, the plain chunks of the
+//two are decoded together by decPairChunks, the other entries and the chunks left over by the shorter job one at
+//a time by decEntry, sets the sizes of the jobs, 0 - both decoded
+static int
+decJobPair(struct SegmentJob *jobs, const struct Arans *const *bases, struct Arans *models, const int *checksums,
+           struct AransPool *split) {
+    const unsigned flags = CHUNK_STORED | CHUNK_MODEL | CHUNK_LEVELS | CHUNK_WAYS;
+    size_t out_pos[2] = {0, 0};
+    size_t sizes[2] = {0, 0};
+    size_t c[2] = {0, 0};
+
+    while ((c[0] < jobs[0].count) || (c[1] < jobs[1].count)) {
+        const struct AransChunk *chunks[2];
+
+        for (int k = 0; k < 2; ++k)
+            chunks[k] = c[k] < jobs[k].count ? &jobs[k].chunks[c[k]] : NULL;
+
+        if (chunks[0] && chunks[1] && !(chunks[0]->flags & flags) && !(chunks[1]->flags & flags)) {
+            unsigned char *outs[2] = {&jobs[0].out[out_pos[0]], &jobs[1].out[out_pos[1]]};
+
+            if (decPairChunks(models, bases, outs, jobs, chunks, checksums))
+                return 1;
+
+            for (int k = 0; k < 2; ++k) {
+                out_pos[k] += chunks[k]->symbols;
+                sizes[k] += chunks[k]->size;
+                ++c[k];
+            }
+
+            continue;
+        }
+
+        int k = !chunks[1] || (chunks[0] && (chunks[0]->flags & flags)) ? 0 : 1;
+
+        if (decEntry(&models[k], bases[k], &jobs[k].out[out_pos[k]], jobs[k].in, chunks[k], checksums[k], split))
+            return 1;
+
+        out_pos[k] += chunks[k]->symbols;
+        sizes[k] += chunks[k]->size;
+        ++c[k];
+    }
+
+    jobs[0].size = sizes[0];
+    jobs[1].size = sizes[1];
+    return 0;
+}
+
+//decodes two plain chunks, chunk k of the stream of job k with models[k], the steps of the chunks alternate,
+//the states of one do not depend on the other, so the table loads and renormalization of the two overlap
+static int
+decPairChunks(struct Arans *models, const struct Arans *const *bases, unsigned char **outs,
+              const struct SegmentJob *jobs, const struct AransChunk **chunks, const int *checksums) {
+    uint32_t cod[2][RANGE_LEVELS];
+    unsigned char *ptr[2];
+    size_t common = chunks[0]->symbols < chunks[1]->symbols ? chunks[0]->symbols : chunks[1]->symbols;
+
+    for (int k = 0; k < 2; ++k) {
+        const unsigned char *lim = &jobs[k].in[chunks[k]->offset + chunks[k]->size];
+
+        if (chunks[k]->flags & CHUNK_RESET)
+            models[k] = *bases[k];
+
+        ptr[k] = (unsigned char *) &jobs[k].in[chunks[k]->offset];
+
+        for (size_t level = 0; level < RANGE_LEVELS; ++level)
+            if (decInit(&cod[k][level], &ptr[k], lim))
+                return 1;
+    }
+
+    for (size_t i = 0; i < common; ++i) {
+        if (decAransStep(&models[0], &outs[0][i], cod[0], &ptr[0]) ||
+            decAransStep(&models[1], &outs[1][i], cod[1], &ptr[1]))
+            return 1;
+    }
+
+    for (int k = 0; k < 2; ++k) {
+        for (size_t i = common; i < chunks[k]->symbols; ++i)
+            if (decAransStep(&models[k], &outs[k][i], cod[k], &ptr[k]))
+                return 1;
+
+        for (size_t level = 0; level < RANGE_LEVELS; ++level)
+            if (cod[k][level] != CODE_NORM)
+                return 1;
+
+        if ((size_t) (ptr[k] - &jobs[k].in[chunks[k]->offset]) != chunks[k]->size)
+            return 1;
+
+        if (checksums[k] && (~crcBlock(CRC_INIT, outs[k], chunks[k]->symbols) != chunks[k]->crc))
+            return 1;
+    }
+
+    return 0;
+}
+
+//decodes the entry chunk of in into out, levels runs the levels of a CHUNK_LEVELS chunk, NULL - one pass
+static int
+decEntry(struct Arans *model, const struct Arans *base, unsigned char *out, const unsigned char *in,
+         const struct AransChunk *chunk, int checksum, struct AransPool *levels) {
+    unsigned ways = 1u << ((chunk->flags & CHUNK_WAYS) >> CHUNK_WAYS_SHIFT);
+    uint32_t crc = CRC_INIT;
+
+    if (chunk->flags & CHUNK_RESET)
+        *model = *base;
+
+    if (chunk->flags & CHUNK_MODEL)
+        return chunk->symbols || getModel(model, base, &in[chunk->offset], chunk->size);
+
+    if (chunk->flags & CHUNK_STORED) {
+        if (chunk->size != chunk->symbols)
+            return 1;
+
+        memcpy(out, &in[chunk->offset], chunk->size);
+
+        if (checksum)
+            crc = crcBlock(crc, out, chunk->symbols);
+    } else if (chunk->flags & CHUNK_LEVELS) {
+        //substreams have one state per level
+        if ((ways > 1) ||
+            decLevelChunk(model, out, chunk->symbols, &in[chunk->offset], chunk->size, checksum ? &crc : NULL, levels))
+            return 1;
+    } else if (ways > 1) {
+        if (decAransWays(model, out, chunk->symbols, &in[chunk->offset], chunk->size, checksum ? &crc : NULL, ways) !=
+            chunk->size)
+            return 1;
+    } else if (decAransChunk(model, out, chunk->symbols, &in[chunk->offset], chunk->size, checksum ? &crc : NULL) !=
+               chunk->size) {
+        return 1;
+    }
+
+    return checksum && (~crc != chunk->crc);
+}
+
+//decodes a CHUNK_LEVELS chunk of in_size bytes, the last substream takes the bytes left after the others,
+//with a pool every level is a task of its own
+static int
+decLevelChunk(struct Arans *model, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size,
+              uint32_t *crc, struct AransPool *pool) {
+    const unsigned char *ptr = in;
+    const unsigned char *lim = &in[in_size];
+    size_t sizes[RANGE_LEVELS];
+    size_t size = 0;
+
+    for (size_t level = 0; level + 1 < RANGE_LEVELS; ++level) {
+        uint64_t val;
+
+        if (getVarint(&val, &ptr, lim) || (val > in_size))
+            return 1;
+
+        sizes[level] = val;
+        size += val;
+    }
+
+    if (size > (size_t) (lim - ptr))
+        return 1;
+
+    sizes[RANGE_LEVELS - 1] = (lim - ptr) - size;
+
+    if (!pool)
+        return decAransLevels(model, out, out_size, ptr, sizes, crc);
+
+    struct LevelChunk chunk = {model, out, out_size, ptr, {0}, {0}, 0};
+
+    memcpy(chunk.sizes, sizes, sizeof(sizes));
+    atomic_init(&chunk.failed, 0);
+
+    for (size_t level = 0; level < RANGE_LEVELS; ++level)
+        atomic_init(&chunk.done[level], 0);
+
+    aransPoolRun(pool, RANGE_LEVELS, decLevelTask, &chunk);
+
+    if (atomic_load(&chunk.failed))
+        return 1;
+
+    if (crc)
+        *crc = crcBlock(*crc, out, out_size);
+
+    return 0;
+}
+
+//task level decodes its level of the chunk, the pool hands out the levels in order,
+//so the level it waits for has always been taken by a running thread
+static void decLevelTask(void *ctx, size_t level) {
+    struct LevelChunk *chunk = (struct LevelChunk *) ctx;
+    const unsigned char *lim = chunk->in;
+
+    for (size_t i = 0; i <= level; ++i)
+        lim = &lim[chunk->sizes[i]];
+
+    unsigned char *ptr = (unsigned char *) &lim[-chunk->sizes[level]];
+    uint32_t cod = 0;
+
+    for (size_t first = 0; first < chunk->out_size; first += LEVEL_STEP) {
+        size_t count = chunk->out_size - first < LEVEL_STEP ? chunk->out_size - first : LEVEL_STEP;
+
+        //the levels above put their bits first
+        while (level && !atomic_load(&chunk->failed) && (atomic_load(&chunk->done[level - 1]) < first + count))
+            sched_yield();
+
+        if (atomic_load(&chunk->failed) ||
+            decAransLevel(chunk->model, level, chunk->out, first, count, &cod, &ptr, lim)) {
+            atomic_store(&chunk->failed, 1);
+            return;
+        }
+
+        atomic_store(&chunk->done[level], first + count);
+    }
+
+    //every level ends where its substream does
+    if ((cod != CODE_NORM) || (ptr != lim))
+        atomic_store(&chunk->failed, 1);
+}
+
+static int getModel(struct Arans *model, const struct Arans *base, const unsigned char *in, size_t in_size) {
+    uint16_t cur[MODEL_WORDS];
+    const unsigned char *ptr = in;
+    const unsigned char *lim = &in[in_size];
+
+    memcpy(cur, base, sizeof(cur));
+
+    for (size_t i = 0; i < MODEL_WORDS;) {
+        uint64_t run;
+        uint64_t delta;
+
+        if (getVarint(&run, &ptr, lim) || (run > MODEL_WORDS - i))
+            return 1;
+
+        i += run;
+
+        if (i == MODEL_WORDS)
+            break;
+
+        if (getVarint(&delta, &ptr, lim) || (delta > 0xFFFF))
+            return 1;
+
+        cur[i++] += (uint16_t) (delta >> 1 ^ -(delta & 1));
+    }
+
+    if (ptr != lim)
+        return 1;
+
+    memcpy(model, cur, sizeof(cur));
+    return 0;
+}
+
+//reads the index of an in_size byte stream from its first head_size bytes and its last end_size bytes,
+//so a file needs only its frame header and its index in memory
+static int getIndex(struct AransIndex *index, const unsigned char *head, size_t head_size, const unsigned char *end,
+                    size_t end_size, size_t in_size) {
+    index->count = 0;
+    index->chunks = NULL;
+
+    if (aransReadFrame(&index->frame, head, head_size) || aransCheckFrame(&index->frame))
+        return 1;
+
+    size_t header_size = index->frame.header_size;
+
+    if ((in_size < header_size + INDEX_TAIL_SIZE) || (end_size < INDEX_TAIL_SIZE) || (end_size > in_size))
+        return 1;
+
+    const unsigned char *tail = &end[end_size - INDEX_TAIL_SIZE];
+    size_t index_size = (size_t) tail[0] << 24 | tail[1] << 16 | tail[2] << 8 | tail[3];
+
+    if ((index_size > in_size - header_size - INDEX_TAIL_SIZE) || (index_size > end_size - INDEX_TAIL_SIZE))
+        return 1;
+
+    const unsigned char *ptr = &tail[-index_size];
+    uint64_t count;
+
+    size_t entry_size = index->frame.flags & FRAME_CHECKSUM ? 3 + CRC_SIZE : 3;
+
+    //every chunk takes at least three index bytes and its crc
+    if (getVarint(&count, &ptr, tail) || (count > (size_t) (tail - ptr) / entry_size))
+        return 1;
+
+    index->chunks = (struct AransChunk *) malloc(count * sizeof(struct AransChunk) + 1);
+
+    if (!index->chunks)
+        return 1;
+
+    size_t offset = header_size;
+    size_t limit = in_size - INDEX_TAIL_SIZE - index_size;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t size;
+        uint64_t symbols;
+
+        if (getVarint(&size, &ptr, tail) || getVarint(&symbols, &ptr, tail) || ((size_t) (tail - ptr) < entry_size - 2) ||
+            (*ptr & ~CHUNK_FLAGS) || (size > limit - offset)) {
+            aransFreeIndex(index);
+            return 1;
+        }
+
+        index->chunks[i] = (struct AransChunk) {offset, size, symbols, *ptr++, 0};
+        offset += size;
+
+        if (index->frame.flags & FRAME_CHECKSUM) {
+            index->chunks[i].crc = (uint32_t) ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3];
+            ptr += CRC_SIZE;
+        }
+    }
+
+    index->count = count;
+
+    if ((ptr != tail) || (offset != limit)) {
+        aransFreeIndex(index);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int getVarint(uint64_t *val, const unsigned char **pptr, const unsigned char *lim) {
+    const unsigned char *ptr = *pptr;
+    uint64_t x = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (ptr >= lim)
+            return 1;
+
+        unsigned char b = *ptr++;
+        x |= (uint64_t) (b & 0x7F) << shift;
+
+        if (!(b & 0x80)) {
+            *val = x;
+            *pptr = ptr;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Decoder
+
+
+// Container
+
+//public function declarations
+STORAGE_SPEC size_t aransConcatBound(const size_t *, size_t);
+
+STORAGE_SPEC size_t
+aransConcat(unsigned char *, size_t, const unsigned char *const *, const size_t *, size_t);
+
+STORAGE_SPEC size_t
+aransAppend(struct Arans *, const struct AransOptions *, unsigned char *, size_t, size_t, const unsigned char *, size_t);
+
+//public functions
+STORAGE_SPEC size_t aransConcatBound(const size_t *in_sizes, size_t count) {
+    //every joined stream drops a frame header and an index size
+    size_t size = FRAME_MAX_SIZE + VARINT_MAX_SIZE;
+
+    for (size_t i = 0; i < count; ++i)
+        size += in_sizes[i];
+
+    return size;
+}
+
+STORAGE_SPEC size_t
+aransConcat(unsigned char *out, size_t out_size, const unsigned char *const *ins, const size_t *in_sizes,
+            size_t count) {
+    struct AransIndex *indexes = (struct AransIndex *) calloc(count + 1, sizeof(struct AransIndex));
+    struct AransIndex index = {{0}, 0, NULL};
+    uint64_t size = 0;
+    unsigned flags = count ? FRAME_FLAGS : 0;
+    size_t ret = 0;
+
+    if (!indexes)
+        return 0;
+
+    int failed = 0;
+
+    for (size_t i = 0; !failed && (i < count); ++i) {
+        const struct AransFrame *frame = &indexes[i].frame;
+
+        //the model is reset to the same state at every seam
+        failed = aransReadIndex(&indexes[i], ins[i], in_sizes[i]) || (frame->dict != indexes[0].frame.dict) ||
+                 (frame->size > UINT64_MAX - size);
+
+        size += frame->size;
+        flags &= frame->flags;
+        index.count += indexes[i].count;
+    }
+
+    index.frame.flags = flags;
+    index.chunks = (struct AransChunk *) malloc(index.count * sizeof(struct AransChunk) + 1);
+
+    if (!failed && index.chunks && (out_size >= FRAME_MAX_SIZE)) {
+        size_t out_pos = putFrame(out, size, flags, count ? indexes[0].frame.dict : 0);
+        size_t k = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            const struct AransIndex *part = &indexes[i];
+
+            if (!part->count)
+                continue;
+
+            //chunks of a stream are contiguous from the end of its frame header
+            size_t first = part->frame.header_size;
+            size_t last = part->chunks[part->count - 1].offset + part->chunks[part->count - 1].size;
+
+            if (last - first > out_size - out_pos)
+                break;
+
+            memcpy(&out[out_pos], &ins[i][first], last - first);
+
+            for (size_t c = 0; c < part->count; ++c) {
+                index.chunks[k] = part->chunks[c];
+                index.chunks[k].offset += out_pos - first;
+                index.chunks[k].flags |= c ? 0 : CHUNK_RESET;
+                ++k;
+            }
+
+            out_pos += last - first;
+        }
+
+        if (k == index.count)
+            ret = putIndex(&out[out_pos], out_size - out_pos, &index);
+
+        if (ret)
+            ret += out_pos;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        aransFreeIndex(&indexes[i]);
+
+    free(index.chunks);
+    free(indexes);
+    return ret;
+}
+
+//appends in to the FRAME_APPEND stream held in the first stream_size bytes of out and returns the new stream size,
+//only the frame header, the index and the final model are read, so out may map a file,
+//out_size of stream_size + aransBoundEx(options, in_size) with options->append set is always enough,
+//arans holds the model passed to the encoder of the stream, the stream is left unchanged on failure
+STORAGE_SPEC size_t
+aransAppend(struct Arans *arans, const struct AransOptions *options, unsigned char *out, size_t out_size,
+            size_t stream_size, const unsigned char *in, size_t in_size) {
+    struct AransIndex index;
+
+    if (aransReadIndex(&index, out, stream_size))
+        return 0;
+
+    struct AransFrame *frame = &index.frame;
+    const struct AransChunk *tail = index.count ? &index.chunks[index.count - 1] : NULL;
+    struct Arans base = *arans;
+    struct Arans model;
+    unsigned char *saved = NULL;
+    size_t ret = 0;
+
+    //the old index is overwritten by the new chunks, a copy restores it on failure
+    if ((frame->flags & FRAME_APPEND) && tail && (tail->flags & CHUNK_MODEL) && (frame->dict == options->dict) &&
+        (in_size <= UINT64_MAX - frame->size) && !getModel(&model, &base, &out[tail->offset], tail->size) &&
+        (saved = (unsigned char *) malloc(stream_size - tail->offset - tail->size + 1))) {
+        struct AransOptions resumed = *options;
+        size_t out_pos = tail->offset + tail->size;
+        size_t prior = 0;
+
+        resumed.checksum = frame->flags & FRAME_CHECKSUM;
+        memcpy(saved, &out[out_pos], stream_size - out_pos);
+
+        //the new chunks continue the segment of the last chunk
+        for (size_t i = index.count; i > 0; --i) {
+            prior += !(index.chunks[i - 1].flags & CHUNK_MODEL);
+
+            if (index.chunks[i - 1].flags & CHUNK_RESET)
+                break;
+        }
+
+        size_t pos = encStream(&model, &base, &resumed, prior, out, out_size, out_pos, in, in_size, &index);
+
+        if (pos)
+            ret = encFinish(&model, &base, out, out_size, pos, &index);
+
+        if (ret)
+            putVarintFixed(&out[FRAME_FIXED_SIZE], frame->size + in_size);
+        else
+            memcpy(&out[out_pos], saved, stream_size - out_pos);
+    }
+
+    free(saved);
+    aransFreeIndex(&index);
+    return ret;
+}
+
+// Container
+
+
+// Messages
+
+//public function declarations
+STORAGE_SPEC size_t aransSmallBound(size_t);
+
+STORAGE_SPEC size_t aransEncodeSmall(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC int aransSmallSize(size_t *, const unsigned char *, size_t);
+
+STORAGE_SPEC size_t aransDecodeSmall(struct Arans *, unsigned char *, size_t, const unsigned char *, size_t);
+
+STORAGE_SPEC size_t aransBatchBound(const size_t *, size_t);
+
+STORAGE_SPEC size_t
+aransEncodeBatch(const struct Arans *, unsigned char *, size_t, const unsigned char *const *, const size_t *, size_t,
+                 size_t *);
+
+STORAGE_SPEC size_t
+aransDecodeBatch(const struct Arans *, unsigned char *const *, const size_t *, const unsigned char *, const size_t *,
+                 size_t);
+
+//internal function declarations
+static size_t encBatchLanes(const struct Arans *, struct Range *, unsigned char *, const unsigned char *const *,
+                            const size_t *, size_t, size_t *);
+
+//public functions
+STORAGE_SPEC size_t aransSmallBound(size_t in_size) {
+    return in_size + varintSize((uint64_t) in_size << 2);
+}
+
+//codes in as a small message of at most SMALL_MAX_SIZE bytes, arans holds the model and receives the final one
+//like in aransEncode, a stored message leaves it unchanged
+STORAGE_SPEC size_t
+aransEncodeSmall(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
+    size_t head = varintSize((uint64_t) in_size << 2);
+
+    if ((in_size > SMALL_MAX_SIZE) || (out_size < head + in_size))
+        return 0;
+
+    struct Arans saved = *arans;
+    unsigned char *end = &out[head + in_size];
+    unsigned char *ptr = end;
+    uint32_t state = SMALL_STATE;
+
+    //the coded bytes may take no more room than the stored ones
+    if (!encAransSmall(arans, &ptr, &out[head], in, in_size, &state)) {
+        size_t size = end - ptr;
+        size_t bytes = 1;
+
+        while ((bytes < 4) && (state >> 8 * bytes))
+            ++bytes;
+
+        if (bytes + size < in_size) {
+            memmove(&out[head + bytes], ptr, size);
+            putVarint(out, (uint64_t) in_size << 2 | (bytes - 1));
+
+            for (size_t i = 0; i < bytes; ++i)
+                out[head + i] = state >> 8 * (bytes - 1 - i);
+
+            return head + bytes + size;
+        }
+    }
+
+    *arans = saved;
+    putVarint(out, (uint64_t) in_size << 2);
+    memcpy(&out[head], in, in_size);
+    return head + in_size;
+}
+
+//reads the number of bytes a small message decodes to
+STORAGE_SPEC int aransSmallSize(size_t *size, const unsigned char *in, size_t in_size) {
+    const unsigned char *ptr = in;
+    uint64_t head;
+
+    if (getVarint(&head, &ptr, &in[in_size]) || ((head >> 2) > SMALL_MAX_SIZE))
+        return 1;
+
+    *size = head >> 2;
+    return 0;
+}
+
+//decodes a small message of exactly in_size bytes, arans holds the model the encoder started from
+STORAGE_SPEC size_t
+aransDecodeSmall(struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *in, size_t in_size) {
+    const unsigned char *ptr = in;
+    const unsigned char *lim = &in[in_size];
+    uint64_t head;
+
+    if (getVarint(&head, &ptr, lim) || ((head >> 2) > SMALL_MAX_SIZE) || ((head >> 2) > out_size))
+        return 0;
+
+    size_t size = head >> 2;
+    size_t bytes = (head & 3) + 1;
+    size_t rest = lim - ptr;
+
+    //a coded message is always shorter than the stored one
+    if (rest == size) {
+        if (head & 3)
+            return 0;
+
+        memcpy(out, ptr, size);
+        return in_size;
+    }
+
+    if ((rest > size) || (rest < bytes))
+        return 0;
+
+    uint32_t state = 0;
+
+    for (size_t i = 0; i < bytes; ++i)
+        state = state << 8 | *ptr++;
+
+    if (decAransSmall(arans, out, size, &ptr, lim, &state) || (state != SMALL_STATE) || (ptr != lim))
+        return 0;
+
+    return in_size;
+}
+
+STORAGE_SPEC size_t aransBatchBound(const size_t *in_sizes, size_t count) {
+    size_t size = 0;
+
+    for (size_t i = 0; i < count; ++i)
+        size += aransSmallBound(in_sizes[i]);
+
+    return size;
+}
+
+//codes count messages as small messages written one after another, each from a copy of arans like
+//aransEncodeSmall, sizes receives the size of every message, returns the number of bytes written
+STORAGE_SPEC size_t
+aransEncodeBatch(const struct Arans *arans, unsigned char *out, size_t out_size, const unsigned char *const *ins,
+                 const size_t *in_sizes, size_t count, size_t *sizes) {
+    struct Range *range = (struct Range *) threadScratch(SCRATCH_RANGES, BATCH_LANES * RANGE_LEVELS * CHUNK_SIZE *
+                                                                         sizeof(struct Range), alignof(struct Range));
+    size_t pos = 0;
+
+    if (!range)
+        return 0;
+
+    for (size_t i = 0; i < count; i += BATCH_LANES) {
+        size_t lanes = count - i < BATCH_LANES ? count - i : BATCH_LANES;
+
+        if (aransBatchBound(&in_sizes[i], lanes) > out_size - pos) {
+            pos = 0;
+            break;
+        }
+
+        size_t size = encBatchLanes(arans, range, &out[pos], &ins[i], &in_sizes[i], lanes, &sizes[i]);
+        if (!size) {
+            pos = 0;
+            break;
+        }
+
+        pos += size;
+    }
+
+    return pos;
+}
+
+//decodes count small messages coded by aransEncodeBatch from arans, message i takes sizes[i] bytes of in
+//and decodes to outs[i], which holds out_sizes[i] bytes, returns the number of bytes read
+STORAGE_SPEC size_t
+aransDecodeBatch(const struct Arans *arans, unsigned char *const *outs, const size_t *out_sizes,
+                 const unsigned char *in, const size_t *sizes, size_t count) {
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i += BATCH_LANES) {
+        size_t lanes = count - i < BATCH_LANES ? count - i : BATCH_LANES;
+        struct Arans model[BATCH_LANES];
+        const unsigned char *ptr[BATCH_LANES];
+        const unsigned char *lim[BATCH_LANES];
+        uint32_t state[BATCH_LANES];
+        size_t size[BATCH_LANES];
+        size_t steps = 0;
+
+        for (size_t j = 0; j < lanes; ++j) {
+            uint64_t head;
+            ptr[j] = &in[pos];
+            lim[j] = &in[pos + sizes[i + j]];
+            pos += sizes[i + j];
+
+            if (getVarint(&head, &ptr[j], lim[j]) || ((head >> 2) > SMALL_MAX_SIZE) ||
+                ((head >> 2) > out_sizes[i + j]))
+                return 0;
+
+            size_t bytes = (head & 3) + 1;
+            size_t rest = lim[j] - ptr[j];
+            size[j] = head >> 2;
+
+            //a stored message takes no lane
+            if (rest == size[j]) {
+                if (head & 3)
+                    return 0;
+
+                memcpy(outs[i + j], ptr[j], size[j]);
+                size[j] = 0;
+                ptr[j] = lim[j];
+                state[j] = SMALL_STATE;
+                continue;
+            }
+
+            if ((rest > size[j]) || (rest < bytes))
+                return 0;
+
+            state[j] = 0;
+
+            for (size_t k = 0; k < bytes; ++k)
+                state[j] = state[j] << 8 | *ptr[j]++;
+
+            model[j] = *arans;
+            steps = size[j] > steps ? size[j] : steps;
+        }
+
+        for (size_t k = 0; k < steps; k += BATCH_STEP)
+            for (size_t j = 0; j < lanes; ++j)
+                if (k < size[j]) {
+                    size_t step = size[j] - k < BATCH_STEP ? size[j] - k : BATCH_STEP;
+
+                    if (decAransSmall(&model[j], &outs[i + j][k], step, &ptr[j], lim[j], &state[j]))
+                        return 0;
+                }
+
+        for (size_t j = 0; j < lanes; ++j)
+            if ((state[j] != SMALL_STATE) || (ptr[j] != lim[j]))
+                return 0;
+    }
+
+    return pos;
+}
+
+//internal functions
+//codes lanes messages side by side into out, which holds aransBatchBound of them, range holds BATCH_LANES
+//range arrays of encAransModel, every message is coded into the room of its bound first and moved down after
+static size_t encBatchLanes(const struct Arans *arans, struct Range *range, unsigned char *out,
+                            const unsigned char *const *ins, const size_t *in_sizes, size_t lanes, size_t *sizes) {
+    encRcpInit();
+
+    struct Arans model[BATCH_LANES];
+    unsigned char *ptr[BATCH_LANES];
+    unsigned char *lim[BATCH_LANES];
+    uint32_t state[BATCH_LANES];
+    int failed[BATCH_LANES];
+    size_t steps = 0;
+    size_t pos = 0;
+
+    for (size_t j = 0; j < lanes; ++j) {
+        if (in_sizes[j] > SMALL_MAX_SIZE)
+            return 0;
+
+        lim[j] = &out[pos + varintSize((uint64_t) in_sizes[j] << 2)];
+        ptr[j] = &lim[j][in_sizes[j]];
+        pos += aransSmallBound(in_sizes[j]);
+        state[j] = SMALL_STATE;
+        failed[j] = 0;
+        model[j] = *arans;
+        steps = in_sizes[j] > steps ? in_sizes[j] : steps;
+    }
+
+    for (size_t k = 0; k < steps; k += BATCH_STEP)
+        for (size_t j = 0; j < lanes; ++j)
+            if (k < in_sizes[j]) {
+                size_t step = in_sizes[j] - k < BATCH_STEP ? in_sizes[j] - k : BATCH_STEP;
+                encAransModel(&model[j], &range[j * RANGE_LEVELS * CHUNK_SIZE + k], &ins[j][k], step, NULL);
+            }
+
+    //every message runs its symbols from the last one down, the last level of a symbol first like encAransSmall
+    for (size_t k = 0; k < steps; ++k)
+        for (size_t j = 0; j < lanes; ++j)
+            if ((k < in_sizes[j]) && !failed[j]) {
+                const struct Range *lane = &range[j * RANGE_LEVELS * CHUNK_SIZE + in_sizes[j] - 1 - k];
+
+                for (size_t level = RANGE_LEVELS; level > 0; --level)
+                    failed[j] |= encPut(&state[j], &ptr[j], lim[j], lane[(level - 1) * CHUNK_SIZE]);
+            }
+
+    pos = 0;
+
+    for (size_t j = 0; j < lanes; ++j) {
+        size_t head = varintSize((uint64_t) in_sizes[j] << 2);
+        size_t size = &lim[j][in_sizes[j]] - ptr[j];
+        size_t bytes = 1;
+
+        while ((bytes < 4) && (state[j] >> 8 * bytes))
+            ++bytes;
+
+        //the message is written at pos, which is never past its room, the coded bytes sit at the end of the room
+        if (!failed[j] && (bytes + size < in_sizes[j])) {
+            memmove(&out[pos + head + bytes], ptr[j], size);
+            putVarint(&out[pos], (uint64_t) in_sizes[j] << 2 | (bytes - 1));
+
+            for (size_t i = 0; i < bytes; ++i)
+                out[pos + head + i] = state[j] >> 8 * (bytes - 1 - i);
+
+            sizes[j] = head + bytes + size;
+        } else {
+            putVarint(&out[pos], (uint64_t) in_sizes[j] << 2);
+            memcpy(&out[pos + head], ins[j], in_sizes[j]);
+            sizes[j] = head + in_sizes[j];
+        }
+
+        pos += sizes[j];
+    }
+
+    return pos;
+}
+
+// Messages
+
+#include "arans_pipe.h"
+#include "arans_jobs.h"
+
+#endif //ARANS_STREAM_H
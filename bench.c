@@ -0,0 +1,200 @@
+//sweeps every variant over input sizes from -min to -max bytes (x4 per step) and thread counts from 1 to -T (x2 per
+//step and -T itself) and prints one record per configuration as CSV or, with -json, as a JSON array:
+//  arans_bench [file] [-min N] [-max N] [-T N] [-json]
+//the input is file repeated up to the size, without file a generated text-like input,
+//cycles are time stamp counter ticks, the efficiency is the speedup over one thread divided by the thread count,
+//the largest input is held three times over (input, stream and decoded copy)
+
+//includes
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+//constants
+#define BENCH_RUNS 3                //number of timed runs per configuration, the best one counts
+#define BENCH_LARGE (1 << 26)       //inputs from this size on are timed once
+#define BENCH_MIN (1 << 10)         //default smallest input
+#define BENCH_MAX (1 << 30)         //default largest input
+#define BENCH_SEGMENTS 4            //independent segments per thread of the largest thread count
+
+//structs
+struct BenchVariant {
+    const char *name;
+    int (*run)(const unsigned char *, size_t, int, size_t, int, struct BenchResult *);
+};
+
+//internal function declarations
+static unsigned char *benchInput(const char *, size_t);
+
+static size_t benchStep(size_t, size_t, size_t);
+
+static void benchPrint(int, int, const char *, size_t, int, const struct BenchResult *,
+                       const struct BenchResult *);
+
+//public functions
+int main(int argc, char **argv) {
+#define BENCH_ITEM(id) {#id, BENCH_ENTRY(id)},
+    static const struct BenchVariant variants[] = {BENCH_VARIANTS(BENCH_ITEM)};
+#undef BENCH_ITEM
+    const char *file = NULL;
+    size_t min_size = BENCH_MIN;
+    size_t max_size = BENCH_MAX;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cores > 0 ? (int) cores : 1;
+    int json = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-min") == 0) && (i + 1 < argc))
+            min_size = strtoull(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "-max") == 0) && (i + 1 < argc))
+            max_size = strtoull(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "-T") == 0) && (i + 1 < argc))
+            max_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-json") == 0)
+            json = 1;
+        else if (argv[i][0] != '-')
+            file = argv[i];
+        else {
+            fprintf(stderr, "Unknown argument %s!\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!min_size || (min_size > max_size) || (max_threads < 1)) {
+        fprintf(stderr, "Check the sizes and threads!\n");
+        return 1;
+    }
+
+    unsigned char *in = benchInput(file, max_size);
+
+    if (!in)
+        return 1;
+
+    //the segments do not depend on the thread count, so every thread count codes the same stream
+    size_t segments = (size_t) max_threads * BENCH_SEGMENTS;
+    int first = 1;
+    int failed = 0;
+
+    if (!json)
+        printf("variant,size,threads,segments,ratio,enc_mibs,dec_mibs,enc_cycles_per_byte,dec_cycles_per_byte,"
+               "enc_efficiency,dec_efficiency\n");
+    else
+        printf("[");
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        for (size_t size = min_size;; size = benchStep(size, 4, max_size)) {
+            struct BenchResult single;
+            int runs = size < BENCH_LARGE ? BENCH_RUNS : 1;
+
+            for (int threads = 1;; threads = (int) benchStep(threads, 2, max_threads)) {
+                struct BenchResult result;
+
+                if (variants[v].run(in, size, threads, segments, runs, &result)) {
+                    fprintf(stderr, "Round trip of %s failed for %zu bytes on %d threads!\n", variants[v].name, size,
+                            threads);
+                    failed = 1;
+                    break;
+                }
+
+                if (threads == 1)
+                    single = result;
+
+                benchPrint(json, first, variants[v].name, size, threads, &result, &single);
+                fflush(stdout);
+                first = 0;
+
+                if (threads == max_threads)
+                    break;
+            }
+
+            if (size == max_size)
+                break;
+        }
+    }
+
+    if (json)
+        printf("\n]\n");
+
+    free(in);
+    return failed;
+}
+
+//internal functions
+
+//reads file repeated up to size bytes, without file generates letters with a skewed distribution
+static unsigned char *benchInput(const char *file, size_t size) {
+    static const char letters[] = " etaoinshrdlucmfwypvbgkjqxz.,\n";
+    unsigned char *in = (unsigned char *) malloc(size);
+
+    if (!in) {
+        fprintf(stderr, "Allocate failed!\n");
+        return NULL;
+    }
+
+    if (!file) {
+        uint64_t x = 0x9E3779B97F4A7C15u;
+
+        for (size_t i = 0; i < size; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+
+            //the smaller of two draws makes the first letters the frequent ones
+            size_t a = (x >> 8) % (sizeof(letters) - 1);
+            size_t b = (x >> 40) % (sizeof(letters) - 1);
+            in[i] = letters[a < b ? a : b];
+        }
+
+        return in;
+    }
+
+    FILE *f = fopen(file, "rb");
+    size_t have = f ? fread(in, 1, size, f) : 0;
+
+    if (f)
+        fclose(f);
+
+    if (!have) {
+        fprintf(stderr, "File not found or empty!\n");
+        free(in);
+        return NULL;
+    }
+
+    for (size_t i = have; i < size; ++i)
+        in[i] = in[i - have];
+
+    return in;
+}
+
+//next value of a sweep from value by factor, the last one is max
+static size_t benchStep(size_t value, size_t factor, size_t max) {
+    return value > max / factor ? max : value * factor;
+}
+
+//prints one record, single holds the one-thread result of the same variant and size
+static void benchPrint(int json, int first, const char *name, size_t size, int threads,
+                       const struct BenchResult *result, const struct BenchResult *single) {
+    double mib = (double) size / 1048576.0;
+    double ratio = (double) size / (double) (result->enc_size ? result->enc_size : 1);
+    double enc_mibs = mib / result->enc_time;
+    double dec_mibs = mib / result->dec_time;
+    double enc_cpb = result->enc_ticks / (double) size;
+    double dec_cpb = result->dec_ticks / (double) size;
+    double enc_eff = single->enc_time / (result->enc_time * threads);
+    double dec_eff = single->dec_time / (result->dec_time * threads);
+
+    if (!json) {
+        printf("%s,%zu,%d,%zu,%.4f,%.2f,%.2f,%.2f,%.2f,%.3f,%.3f\n", name, size, threads, result->segments, ratio, enc_mibs,
+               dec_mibs, enc_cpb, dec_cpb, enc_eff, dec_eff);
+        return;
+    }
+
+    printf("%s\n  {\"variant\": \"%s\", \"size\": %zu, \"threads\": %d, \"segments\": %zu, \"ratio\": %.4f, "
+           "\"enc_mibs\": %.2f, \"dec_mibs\": %.2f, \"enc_cycles_per_byte\": %.2f, \"dec_cycles_per_byte\": %.2f, "
+           "\"enc_efficiency\": %.3f, \"dec_efficiency\": %.3f}", first ? "" : ",", name, size, threads, result->segments,
+           ratio, enc_mibs, dec_mibs, enc_cpb, dec_cpb, enc_eff, dec_eff);
+}
@@ -0,0 +1,34 @@
+#ifndef ARANS_BENCH_H
+#define ARANS_BENCH_H
+
+//throughput benchmark: bench.c sweeps the variants, input sizes and thread counts and prints the results,
+//bench_variant.c is built once per variant (BENCH_ID names it, BENCH_HEADER includes it) and times one configuration
+
+//includes
+#include <stddef.h>
+
+//variants the benchmark is built with, keep in step with BENCH_VARIANTS in CMakeLists.txt
+#define BENCH_VARIANTS(X) X(8) X(8_SIMD) X(4x4) X(3x5) X(2x6) X(2x3x3) X(2x2x4) X(2x2x2x2)
+
+#define BENCH_NAME(id) benchVariant_##id
+#define BENCH_ENTRY(id) BENCH_NAME(id)
+
+//structs
+struct BenchResult {
+    size_t enc_size;
+    size_t segments;                //independent segments the input was coded as
+    double enc_time;                //best encode time in seconds
+    double dec_time;
+    double enc_ticks;               //time stamp counter ticks of the best encode
+    double dec_ticks;
+};
+
+//public function declarations
+
+//codes in with threads threads and the input split into segments independent segments, keeps the best of runs
+//runs, 0 - the round trip succeeded
+#define BENCH_DECLARE(id) int BENCH_ENTRY(id)(const unsigned char *, size_t, int, size_t, int, struct BenchResult *);
+
+BENCH_VARIANTS(BENCH_DECLARE)
+
+#endif //ARANS_BENCH_H
@@ -0,0 +1,75 @@
+#define ARANS_STATIC
+#define _GNU_SOURCE                 //cpu_set_t for pinned workers
+
+//times one variant, built once per variant with BENCH_ID and BENCH_HEADER set, see bench.h
+
+//includes
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "bench.h"
+
+#include BENCH_HEADER
+
+//public functions
+int BENCH_ENTRY(BENCH_ID)(const unsigned char *in, size_t in_size, int threads, size_t segments, int runs,
+                          struct BenchResult *result) {
+    struct Arans arans;
+    struct AransOptions options;
+    size_t chunks = (in_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    aransDefaultOptions(&options);
+    options.threads = threads;
+    options.segment = segments > 1 ? (chunks + segments - 1) / segments : 0;
+    result->segments = options.segment ? (chunks + options.segment - 1) / options.segment : 1;
+
+    //the pool is started once, so the timed runs do not include thread creation
+    if (threads > 1)
+        options.pool = aransPoolCreate(threads);
+
+    size_t bound = aransBoundEx(&options, in_size);
+    unsigned char *enc = (unsigned char *) malloc(bound);
+    unsigned char *dec = (unsigned char *) malloc(in_size + 1);
+    int ret = !enc || !dec || ((threads > 1) && !options.pool);
+
+    result->enc_time = result->dec_time = 1e300;
+
+    for (int run = 0; !ret && (run < runs); ++run) {
+        aransInit(&arans);
+        double start_time = timer();
+        uint64_t start_ticks = __rdtsc();
+        size_t enc_size = aransEncodeEx(&arans, &options, enc, bound, in, in_size);
+        double ticks = (double) (__rdtsc() - start_ticks);
+        double time = timer() - start_time;
+
+        if (time < result->enc_time) {
+            result->enc_time = time;
+            result->enc_ticks = ticks;
+        }
+
+        aransInit(&arans);
+        start_time = timer();
+        start_ticks = __rdtsc();
+        size_t dec_size = aransDecodeEx(&arans, &options, dec, in_size, enc, enc_size);
+        ticks = (double) (__rdtsc() - start_ticks);
+        time = timer() - start_time;
+
+        if (time < result->dec_time) {
+            result->dec_time = time;
+            result->dec_ticks = ticks;
+        }
+
+        //aransDecodeEx returns the number of stream bytes read
+        ret = !enc_size || (dec_size != enc_size) || memcmp(in, dec, in_size);
+        result->enc_size = enc_size;
+    }
+
+    if (options.pool)
+        aransPoolDestroy(options.pool);
+
+    aransScratchFree();
+    free(enc);
+    free(dec);
+    return ret;
+}
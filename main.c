@@ -1,8 +1,10 @@
 #define ARANS_STATIC
+#define _GNU_SOURCE                 //cpu_set_t for pinned workers
 
 //includes
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
 
 #include "platform.h"
 
@@ -18,13 +20,919 @@
 //#include "arans_3x5_clear_arr1.h"
 //#include "arans_SIMD.h"
 
+//constants
+#define BENCH_RUNS 3                //number of timed runs per configuration in bench mode
+#define MANY_SMALL (1 << 16)        //size of the smallest inputs in many mode
+
+//reads the frame header and reports streams this build cannot decode
+static int checkFrame(struct AransFrame *frame, const unsigned char *in, size_t in_size) {
+    if (aransReadFrame(frame, in, in_size)) {
+        printf("Not a compressed file!\n");
+        return 0;
+    }
+
+    if (aransCheckFrame(frame)) {
+        printf("Compressed with version %u, variant %u, rate bits %u, this build decodes version %u, variant %u, "
+               "rate bits %u!\n", frame->version, frame->variant, frame->rate_bits, FRAME_VERSION, ARANS_VARIANT,
+               RATE_BITS);
+        return 0;
+    }
+
+    if (frame->size > SIZE_MAX) {
+        printf("File is too large!\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+//parses the optional arguments: -T threads, -K chunks per independent segment, -C chunk checksums,
+//-S chunks between model snapshots, -D dictionary file, -A appendable stream, -B split model and backward passes,
+//-L substream per level, -W interleaved states per level
+static int parseOptions(struct AransOptions *options, const char **dict, int argc, char *argv[], int first) {
+    aransDefaultOptions(options);
+    *dict = NULL;
+
+    for (int i = first; i < argc; ++i) {
+        if ((strcmp(argv[i], "-T") == 0) && (i + 1 < argc))
+            options->threads = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "-K") == 0) && (i + 1 < argc))
+            options->segment = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-C") == 0)
+            options->checksum = 1;
+        else if ((strcmp(argv[i], "-S") == 0) && (i + 1 < argc))
+            options->checkpoint = strtoull(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "-D") == 0) && (i + 1 < argc))
+            *dict = argv[++i];
+        else if (strcmp(argv[i], "-A") == 0)
+            options->append = 1;
+        else if (strcmp(argv[i], "-B") == 0)
+            options->split = 1;
+        else if (strcmp(argv[i], "-L") == 0)
+            options->levels = 1;
+        else if (strcmp(argv[i], "-P") == 0)
+            options->pin = 1;
+        else if ((strcmp(argv[i], "-N") == 0) && (i + 1 < argc))
+            options->node = atoi(argv[++i]);
+        else {
+            printf("Unknown option %s!\n", argv[i]);
+            return 0;
+        }
+    }
+
+    //a node restricts the CPUs the threads are pinned to
+    options->pin |= options->node != POOL_ALL_NODES;
+    return 1;
+}
+
+//reads a whole file into a new buffer
+static unsigned char *loadFile(const char *name, size_t *size) {
+    FILE *in_file = fopen(name, "rb");
+    if (!in_file) {
+        printf("File not found!\n");
+        return NULL;
+    }
+
+    fseek(in_file, 0, SEEK_END);
+    size_t in_size = ftell(in_file);
+    fseek(in_file, 0, SEEK_SET);
+
+    unsigned char *in = (unsigned char *) malloc(in_size + 1);
+    if (!in) {
+        fclose(in_file);
+        printf("Allocate failed!\n");
+        return NULL;
+    }
+
+    size_t res = fread(in, in_size, 1, in_file);
+    fclose(in_file);
+
+    *size = in_size;
+    return in;
+}
+
+//initializes the model from a dictionary file or the uniform tables and records the dictionary id in options
+static int initModel(struct Arans *arans, struct AransOptions *options, const char *dict) {
+    if (!dict) {
+        aransInit(arans);
+        options->dict = 0;
+        return 1;
+    }
+
+    size_t size;
+    unsigned char *data = loadFile(dict, &size);
+    if (!data)
+        return 0;
+
+    int ret = aransLoadDict(arans, &options->dict, data, size);
+    free(data);
+
+    if (ret) {
+        printf("Not a dictionary for this build!\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+//builds a dictionary from the corpus files
+static int trainDict(const char *name, int count, char *files[]) {
+    unsigned char *corpus = NULL;
+    size_t corpus_size = 0;
+
+    for (int i = 0; i < count; ++i) {
+        size_t size;
+        unsigned char *data = loadFile(files[i], &size);
+        unsigned char *grown = data ? (unsigned char *) realloc(corpus, corpus_size + size + 1) : NULL;
+
+        if (!grown) {
+            free(data);
+            free(corpus);
+            return 0;
+        }
+
+        corpus = grown;
+        memcpy(&corpus[corpus_size], data, size);
+        corpus_size += size;
+        free(data);
+    }
+
+    struct Arans arans;
+    unsigned char *out = (unsigned char *) malloc(DICT_SIZE);
+
+    if (!out || aransTrain(&arans, corpus, corpus_size)) {
+        printf("Allocate failed!\n");
+        free(corpus);
+        free(out);
+        return 0;
+    }
+
+    size_t out_size = aransSaveDict(&arans, out, DICT_SIZE);
+    uint32_t id;
+
+    //the id is read back from the saved bytes, which also checks them
+    if (aransLoadDict(&arans, &id, out, out_size)) {
+        printf("Dictionary check failed!\n");
+        free(corpus);
+        free(out);
+        return 0;
+    }
+
+    FILE *out_file = fopen(name, "wb");
+    if (out_file) {
+        fwrite(out, out_size, 1, out_file);
+        fclose(out_file);
+        printf("%zu bytes of corpus, dictionary %08x, %zu bytes\n", corpus_size, (unsigned) id, out_size);
+    } else {
+        printf("Unable to write!\n");
+    }
+
+    free(corpus);
+    free(out);
+    return 0;
+}
+
+//joins compressed files into one compressed file without recoding them
+static int concatFiles(const char *name, int count, char *files[]) {
+    unsigned char **ins = (unsigned char **) calloc(count, sizeof(unsigned char *));
+    size_t *in_sizes = (size_t *) calloc(count, sizeof(size_t));
+    unsigned char *out = NULL;
+    int loaded = 0;
+
+    for (; ins && in_sizes && (loaded < count); ++loaded) {
+        struct AransFrame frame;
+        ins[loaded] = loadFile(files[loaded], &in_sizes[loaded]);
+
+        if (!ins[loaded] || !checkFrame(&frame, ins[loaded], in_sizes[loaded]))
+            break;
+    }
+
+    if (loaded == count) {
+        size_t out_size = aransConcatBound(in_sizes, count);
+        out = (unsigned char *) malloc(out_size);
+        out_size = out ? aransConcat(out, out_size, (const unsigned char *const *) ins, in_sizes, count) : 0;
+
+        FILE *out_file = out_size ? fopen(name, "wb") : NULL;
+        if (out_file) {
+            fwrite(out, out_size, 1, out_file);
+            fclose(out_file);
+            printf("%d files to %zu bytes\n", count, out_size);
+        } else if (out_size) {
+            printf("Unable to write!\n");
+        } else {
+            printf("Broken file or files coded with different dictionaries!\n");
+        }
+    }
+
+    for (int i = 0; ins && (i < count); ++i)
+        free(ins[i]);
+
+    free(ins);
+    free(in_sizes);
+    free(out);
+    return 0;
+}
+
+//appends a file to a compressed file made with -A, only the frame header and the end of the compressed file
+//are read, the rest of the buffer is never touched
+static int appendFile(const char *name, const char *in_name, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(in_name, &in_size);
+    if (!in)
+        return 0;
+
+    FILE *file = fopen(name, "r+b");
+    if (!file) {
+        free(in);
+        printf("File not found!\n");
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t stream_size = ftell(file);
+    options->append = 1;
+
+    size_t out_size = stream_size + aransBoundEx(options, in_size);
+    unsigned char *out = (unsigned char *) calloc(out_size, 1);
+    struct Arans arans;
+
+    if (!out || (stream_size < FRAME_FIXED_SIZE + INDEX_TAIL_SIZE) || !initModel(&arans, options, dict)) {
+        if (out)
+            printf("Not a compressed file!\n");
+        fclose(file);
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    //frame header, then the index and the final model before it
+    size_t head_size = stream_size < FRAME_MAX_SIZE ? stream_size : FRAME_MAX_SIZE;
+    fseek(file, 0, SEEK_SET);
+    size_t res = fread(out, head_size, 1, file);
+
+    unsigned char *tail = &out[stream_size - INDEX_TAIL_SIZE];
+    fseek(file, stream_size - INDEX_TAIL_SIZE, SEEK_SET);
+    res += fread(tail, INDEX_TAIL_SIZE, 1, file);
+
+    size_t index_size = (size_t) tail[0] << 24 | tail[1] << 16 | tail[2] << 8 | tail[3];
+    size_t tail_size = index_size + INDEX_TAIL_SIZE + MODEL_BOUND;
+
+    if (tail_size > stream_size)
+        tail_size = stream_size;
+
+    fseek(file, stream_size - tail_size, SEEK_SET);
+    res += fread(&out[stream_size - tail_size], tail_size, 1, file);
+
+    if (res != 3) {
+        printf("Unable to read!\n");
+        fclose(file);
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    double start_execution_time = timer();
+    uint64_t start_clocks = __rdtsc();
+
+    size_t size = aransAppend(&arans, options, out, out_size, stream_size, in, in_size);
+
+    uint64_t clocks = __rdtsc() - start_clocks;
+    double execution_time = timer() - start_execution_time;
+
+    if (size) {
+        //the new chunks follow the old final model, the old index is overwritten
+        size_t data_end = stream_size - INDEX_TAIL_SIZE - index_size;
+
+        fseek(file, 0, SEEK_SET);
+        fwrite(out, head_size, 1, file);
+        fseek(file, data_end, SEEK_SET);
+        fwrite(&out[data_end], size - data_end, 1, file);
+
+        printf("%zu appended, %zu to %zu\n", in_size, stream_size, size);
+        printf("%" PRIu64" clocks, %.1f clocks/symbol (%5.1fMiB/s)\n", clocks, (double) clocks / (double) in_size,
+               (double) in_size / (execution_time * 1048576.0));
+    } else {
+        printf("Not an appendable file or another dictionary!\n");
+    }
+
+    fclose(file);
+    free(in);
+    free(out);
+    return 0;
+}
+
+//prints the chunk index of a compressed file without decoding it
+static int listChunks(const char *name) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    struct AransFrame frame;
+    if (!checkFrame(&frame, in, in_size)) {
+        free(in);
+        return 0;
+    }
+
+    struct AransIndex index;
+    if (aransReadIndex(&index, in, in_size)) {
+        free(in);
+        printf("Broken index!\n");
+        return 0;
+    }
+
+    printf("version %u, variant %u, rate bits %u, size %" PRIu64 "%s", frame.version, frame.variant,
+           frame.rate_bits, frame.size, frame.flags & FRAME_CHECKSUM ? ", checksums" : "");
+    if (frame.flags & FRAME_DICT)
+        printf(", dictionary %08x", (unsigned) frame.dict);
+    if (frame.flags & FRAME_APPEND)
+        printf(", appendable");
+    printf("\n");
+    printf("chunk\toffset\tsize\tsymbols\tflags\n");
+    static const char *const ways[] = {"", "W2", "W4", "W8"};
+    for (size_t i = 0; i < index.count; ++i)
+        printf("%zu\t%zu\t%zu\t%zu\t%s%s%s%s%s\n", i, index.chunks[i].offset, index.chunks[i].size,
+               index.chunks[i].symbols, index.chunks[i].flags & CHUNK_RESET ? "R" : "",
+               index.chunks[i].flags & CHUNK_STORED ? "S" : "", index.chunks[i].flags & CHUNK_MODEL ? "M" : "",
+               index.chunks[i].flags & CHUNK_LEVELS ? "L" : "",
+               ways[(index.chunks[i].flags & CHUNK_WAYS) >> CHUNK_WAYS_SHIFT]);
+
+    aransFreeIndex(&index);
+    free(in);
+    return 0;
+}
+
+//encodes and decodes a file in memory with and without chunk checksums and prints the checksum overhead
+static int benchChecksums(const char *name, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    struct Arans arans;
+    size_t bound = aransBoundEx(options, in_size);
+    unsigned char *enc = (unsigned char *) malloc(bound);
+    unsigned char *dec = (unsigned char *) malloc(in_size + 1);
+
+    if (!enc || !dec || !initModel(&arans, options, dict)) {
+        if (!enc || !dec)
+            printf("Allocate failed!\n");
+        free(in);
+        free(enc);
+        free(dec);
+        return 0;
+    }
+
+    double enc_time[2];
+    double dec_time[2];
+
+    for (int checksum = 0; checksum < 2; ++checksum) {
+        options->checksum = checksum;
+
+        size_t enc_size = 0;
+        size_t dec_size = 0;
+        enc_time[checksum] = dec_time[checksum] = 1e300;
+
+        //best of BENCH_RUNS runs
+        for (int run = 0; run < BENCH_RUNS; ++run) {
+            initModel(&arans, options, dict);
+            double start_execution_time = timer();
+            enc_size = aransEncodeEx(&arans, options, enc, bound, in, in_size);
+            double execution_time = timer() - start_execution_time;
+            enc_time[checksum] = execution_time < enc_time[checksum] ? execution_time : enc_time[checksum];
+
+            initModel(&arans, options, dict);
+            start_execution_time = timer();
+            dec_size = aransDecodeEx(&arans, options, dec, in_size, enc, enc_size);
+            execution_time = timer() - start_execution_time;
+            dec_time[checksum] = execution_time < dec_time[checksum] ? execution_time : dec_time[checksum];
+        }
+
+        if (!enc_size || !dec_size || memcmp(in, dec, in_size)) {
+            printf("Round trip failed!\n");
+            break;
+        }
+
+        printf("checksums %s: %zu to %zu, encode %5.1fMiB/s, decode %5.1fMiB/s\n", checksum ? "on " : "off", in_size,
+               enc_size, (double) in_size / (enc_time[checksum] * 1048576.0),
+               (double) in_size / (dec_time[checksum] * 1048576.0));
+
+        if (checksum)
+            printf("checksum overhead: encode %+.1f%%, decode %+.1f%%\n",
+                   100.0 * (enc_time[1] - enc_time[0]) / enc_time[0], 100.0 * (dec_time[1] - dec_time[0]) / dec_time[0]);
+    }
+
+    free(in);
+    free(enc);
+    free(dec);
+    return 0;
+}
+
+//codes the halves of a file as two streams and decodes them on one thread one after another with aransDecodeEx
+//and together with aransDecodePair
+static int benchPair(const char *name, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    struct Arans arans[2];
+    const unsigned char *ins[2] = {in, &in[in_size / 2]};
+    size_t in_sizes[2] = {in_size / 2, in_size - in_size / 2};
+    size_t bounds[2] = {aransBoundEx(options, in_sizes[0]), aransBoundEx(options, in_sizes[1])};
+    unsigned char *enc = (unsigned char *) malloc(bounds[0] + bounds[1]);
+    unsigned char *dec = (unsigned char *) malloc(in_size + 1);
+
+    if (!enc || !dec || !initModel(&arans[0], options, dict)) {
+        if (!enc || !dec)
+            printf("Allocate failed!\n");
+        free(in);
+        free(enc);
+        free(dec);
+        return 0;
+    }
+
+    options->threads = 1;
+
+    unsigned char *encs[2] = {enc, &enc[bounds[0]]};
+    unsigned char *outs[2] = {dec, &dec[in_sizes[0]]};
+    size_t enc_sizes[2];
+
+    for (int k = 0; k < 2; ++k) {
+        initModel(&arans[k], options, dict);
+        enc_sizes[k] = aransEncodeEx(&arans[k], options, encs[k], bounds[k], ins[k], in_sizes[k]);
+    }
+
+    double seq_time = 1e300;
+    double pair_time = 1e300;
+    int failed = !enc_sizes[0] || !enc_sizes[1];
+
+    //best of BENCH_RUNS runs
+    for (int run = 0; !failed && (run < BENCH_RUNS); ++run) {
+        double start_execution_time = timer();
+        for (int k = 0; k < 2; ++k) {
+            initModel(&arans[k], options, dict);
+            failed |= !aransDecodeEx(&arans[k], options, outs[k], in_sizes[k], encs[k], enc_sizes[k]);
+        }
+        double execution_time = timer() - start_execution_time;
+        seq_time = execution_time < seq_time ? execution_time : seq_time;
+        failed |= memcmp(in, dec, in_size) != 0;
+        memset(dec, 0, in_size);
+
+        initModel(&arans[0], options, dict);
+        initModel(&arans[1], options, dict);
+        start_execution_time = timer();
+        failed |= aransDecodePair(arans, options, outs, in_sizes, (const unsigned char *const *) encs, enc_sizes);
+        execution_time = timer() - start_execution_time;
+        pair_time = execution_time < pair_time ? execution_time : pair_time;
+        failed |= memcmp(in, dec, in_size) != 0;
+    }
+
+    if (failed)
+        printf("Round trip failed!\n");
+    else
+        printf("2 streams, %zu to %zu, aransDecodeEx %5.1fMiB/s, aransDecodePair %5.1fMiB/s (%+.1f%%)\n", in_size,
+               enc_sizes[0] + enc_sizes[1], (double) in_size / (seq_time * 1048576.0),
+               (double) in_size / (pair_time * 1048576.0), 100.0 * (seq_time - pair_time) / pair_time);
+
+    free(in);
+    free(enc);
+    free(dec);
+    return 0;
+}
+
+//codes count messages of size bytes of in at once with aransEncodeBatch and aransDecodeBatch
+static void benchBatch(struct Arans *arans, struct AransOptions *options, const char *dict,
+                       const unsigned char *in, size_t in_size, size_t size, size_t count) {
+    const unsigned char **ins = (const unsigned char **) malloc(count * sizeof(unsigned char *));
+    unsigned char **outs = (unsigned char **) malloc(count * sizeof(unsigned char *));
+    size_t *in_sizes = (size_t *) malloc(count * sizeof(size_t));
+    size_t *sizes = (size_t *) malloc(count * sizeof(size_t));
+    unsigned char *dec = (unsigned char *) malloc(in_size + 1);
+    unsigned char *enc = NULL;
+
+    if (ins && outs && in_sizes && sizes && dec) {
+        for (size_t i = 0; i < count; ++i) {
+            ins[i] = &in[i * size];
+            outs[i] = &dec[i * size];
+            in_sizes[i] = in_size - i * size < size ? in_size - i * size : size;
+        }
+
+        enc = (unsigned char *) malloc(aransBatchBound(in_sizes, count));
+    }
+
+    if (!enc) {
+        printf("Allocate failed!\n");
+    } else {
+        initModel(arans, options, dict);
+        double start_execution_time = timer();
+        size_t enc_size = aransEncodeBatch(arans, enc, aransBatchBound(in_sizes, count), ins, in_sizes, count, sizes);
+        double enc_time = timer() - start_execution_time;
+
+        start_execution_time = timer();
+        size_t dec_size = enc_size ? aransDecodeBatch(arans, outs, in_sizes, enc, sizes, count) : 0;
+        double dec_time = timer() - start_execution_time;
+
+        if (!enc_size || (dec_size != enc_size) || memcmp(in, dec, in_size))
+            printf("Batch round trip failed!\n");
+        else
+            printf("batch of %d: %zu bytes, encode %5.1fMiB/s, decode %5.1fMiB/s\n", BATCH_LANES, enc_size,
+                   (double) in_size / (enc_time * 1048576.0), (double) in_size / (dec_time * 1048576.0));
+    }
+
+    free(ins);
+    free(outs);
+    free(in_sizes);
+    free(sizes);
+    free(dec);
+    free(enc);
+}
+
+//codes a file as independent messages of size bytes, each from the initial model, as small messages and as streams
+static int benchMessages(const char *name, size_t size, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    struct Arans arans;
+    size_t bound = aransBoundEx(options, size);
+    unsigned char *enc = (unsigned char *) malloc(bound);
+    unsigned char *dec = (unsigned char *) malloc(size + 1);
+
+    if ((size > SMALL_MAX_SIZE) || !size) {
+        printf("Message size must be 1 to %d bytes!\n", SMALL_MAX_SIZE);
+    } else if (!enc || !dec) {
+        printf("Allocate failed!\n");
+    } else if (initModel(&arans, options, dict)) {
+        size_t count = 0;
+        size_t expanded = 0;
+        uint64_t small_size = 0;
+        uint64_t stream_size = 0;
+        double enc_time = 0;
+        double dec_time = 0;
+
+        for (size_t pos = 0; pos < in_size; pos += size, ++count) {
+            size_t len = in_size - pos < size ? in_size - pos : size;
+
+            initModel(&arans, options, dict);
+            double start_execution_time = timer();
+            size_t enc_size = aransEncodeSmall(&arans, enc, bound, &in[pos], len);
+            enc_time += timer() - start_execution_time;
+
+            initModel(&arans, options, dict);
+            start_execution_time = timer();
+            size_t dec_size = aransDecodeSmall(&arans, dec, size, enc, enc_size);
+            dec_time += timer() - start_execution_time;
+
+            if (!enc_size || !dec_size || memcmp(&in[pos], dec, len)) {
+                printf("Round trip failed at %zu!\n", pos);
+                break;
+            }
+
+            small_size += enc_size;
+            expanded += enc_size > len;
+
+            initModel(&arans, options, dict);
+            stream_size += aransEncodeEx(&arans, options, enc, bound, &in[pos], len);
+        }
+
+        printf("%zu messages of %zu bytes: %zu to %" PRIu64 " (stream format %" PRIu64 "), %zu expanded\n", count,
+               size, in_size, small_size, stream_size, expanded);
+
+        if (count)
+            printf("encode %5.1fMiB/s, decode %5.1fMiB/s\n", (double) in_size / (enc_time * 1048576.0),
+                   (double) in_size / (dec_time * 1048576.0));
+
+        if (count && (count * size >= in_size))
+            benchBatch(&arans, options, dict, in, in_size, size, count);
+    }
+
+    free(in);
+    free(enc);
+    free(dec);
+    return 0;
+}
+
+//adds the result of a job to the counter in its ctx
+static void jobDone(struct AransJob *job) {
+    atomic_fetch_add((atomic_size_t *) job->ctx, job->result);
+}
+
+//submits job to queue, waiting on fd for a completion while the queue is full
+static void submitJob(struct AransQueue *queue, struct AransJob *job, int fd) {
+    uint64_t completed;
+
+    while (aransQueueSubmit(queue, job))
+        if (read(fd, &completed, sizeof(completed)) < 0)
+            break;
+}
+
+//codes a file as independent streams of size bytes through a job queue of options->threads workers,
+//the jobs are submitted from the calling thread, which only waits while the queue is full
+static int benchJobs(const char *name, size_t size, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    int threads = options->threads > 1 ? options->threads : 1;
+    size_t count = size ? (in_size + size - 1) / size : 0;
+    size_t bound = aransBoundEx(options, size);
+    struct Arans *models = (struct Arans *) aligned_alloc(alignof(struct Arans), (count + 1) * sizeof(struct Arans));
+    struct AransJob *jobs = (struct AransJob *) malloc((count + 1) * sizeof(struct AransJob));
+    unsigned char *enc = (unsigned char *) malloc(count * bound + 1);
+    unsigned char *dec = (unsigned char *) malloc(in_size + 1);
+    struct AransQueue *queue = aransQueueCreate(threads, 2 * threads);
+    int fd = eventfd(0, 0);
+    struct AransOptions job_options = *options;
+
+    //every job runs on one worker
+    job_options.threads = 1;
+    job_options.pool = NULL;
+
+    if (!size) {
+        printf("Message size must be at least 1 byte!\n");
+    } else if (!models || !jobs || !enc || !dec || !queue || (fd < 0)) {
+        printf("Allocate failed!\n");
+    } else if (initModel(&models[count], options, dict)) {
+        atomic_size_t enc_size = 0;
+        atomic_size_t dec_size = 0;
+        job_options.dict = options->dict;
+
+        double start_execution_time = timer();
+        for (size_t i = 0; i < count; ++i) {
+            models[i] = models[count];
+            jobs[i] = (struct AransJob) {JOB_ENCODE, &models[i], &job_options, &enc[i * bound], bound, &in[i * size],
+                                         in_size - i * size < size ? in_size - i * size : size, 0, jobDone, &enc_size,
+                                         fd};
+            submitJob(queue, &jobs[i], fd);
+        }
+        aransQueueWait(queue);
+        double enc_time = timer() - start_execution_time;
+
+        int failed = 0;
+
+        start_execution_time = timer();
+        for (size_t i = 0; i < count; ++i) {
+            failed |= !jobs[i].result;
+            models[i] = models[count];
+            jobs[i] = (struct AransJob) {JOB_DECODE, &models[i], &job_options, &dec[i * size], jobs[i].in_size,
+                                         &enc[i * bound], jobs[i].result, 0, jobDone, &dec_size, fd};
+            submitJob(queue, &jobs[i], fd);
+        }
+        aransQueueWait(queue);
+        double dec_time = timer() - start_execution_time;
+
+        for (size_t i = 0; i < count; ++i)
+            failed |= jobs[i].result != jobs[i].in_size;
+
+        if (failed || (dec_size != enc_size) || memcmp(in, dec, in_size))
+            printf("Round trip failed!\n");
+        else
+            printf("%zu jobs of %zu bytes on %d threads: %zu to %zu, encode %5.1fMiB/s, decode %5.1fMiB/s\n", count,
+                   size, threads, in_size, (size_t) enc_size, (double) in_size / (enc_time * 1048576.0),
+                   (double) in_size / (dec_time * 1048576.0));
+    }
+
+    if (queue)
+        aransQueueDestroy(queue);
+    if (fd >= 0)
+        close(fd);
+    free(in);
+    free(models);
+    free(jobs);
+    free(enc);
+    free(dec);
+    return 0;
+}
+
+struct ManyBench {
+    const struct Arans *arans;
+    const struct AransOptions *options;
+    unsigned char **outs;
+    const size_t *out_sizes;
+    const unsigned char **ins;
+    const size_t *in_sizes;
+    size_t count;
+    size_t *sizes;
+    size_t width;
+};
+
+//codes the inputs of thread i of a static partition one after another
+static void manyStaticTask(void *ctx, size_t i) {
+    struct ManyBench *bench = (struct ManyBench *) ctx;
+    struct Arans arans;
+
+    for (size_t k = i; k < bench->count; k += bench->width) {
+        arans = *bench->arans;
+        bench->sizes[k] = aransEncodeEx(&arans, bench->options, bench->outs[k], bench->out_sizes[k], bench->ins[k],
+                                        bench->in_sizes[k]);
+    }
+}
+
+//splits a file into inputs of skewed sizes, half of the file, a quarter and so on down to MANY_SMALL bytes and
+//inputs of MANY_SMALL bytes for the rest, and codes them one after another, as a static partition over the threads
+//and with aransEncodeMany, which steals segments of the large inputs
+static int benchMany(const char *name, struct AransOptions *options, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    size_t count = 0;
+
+    for (size_t pos = 0, part = in_size / 2; pos < in_size; pos += part, ++count, part /= 2)
+        if (part < MANY_SMALL)
+            part = MANY_SMALL;
+
+    int threads = options->threads > 1 ? options->threads : 1;
+    const unsigned char **ins = (const unsigned char **) malloc((count + 1) * sizeof(unsigned char *));
+    unsigned char **outs = (unsigned char **) malloc((count + 1) * sizeof(unsigned char *));
+    size_t *in_sizes = (size_t *) malloc((count + 1) * sizeof(size_t));
+    size_t *out_sizes = (size_t *) malloc((count + 1) * sizeof(size_t));
+    size_t *sizes = (size_t *) malloc(2 * (count + 1) * sizeof(size_t));
+    size_t total = 0;
+
+    for (size_t i = 0, pos = 0, part = in_size / 2; ins && outs && in_sizes && out_sizes && (i < count); ++i) {
+        if (part < MANY_SMALL)
+            part = MANY_SMALL;
+
+        ins[i] = &in[pos];
+        in_sizes[i] = in_size - pos < part ? in_size - pos : part;
+        out_sizes[i] = aransBoundEx(options, in_sizes[i]);
+        total += out_sizes[i];
+        pos += part;
+        part /= 2;
+    }
+
+    unsigned char *enc = (unsigned char *) malloc(2 * total + 1);
+    struct AransPool *pool = aransPoolCreate(threads);
+    struct Arans arans;
+
+    if (!ins || !outs || !in_sizes || !out_sizes || !sizes || !enc || !pool) {
+        printf("Allocate failed!\n");
+    } else if (!count) {
+        printf("Nothing to code!\n");
+    } else if (initModel(&arans, options, dict)) {
+        struct AransOptions one = *options;
+        struct ManyBench bench = {&arans, &one, outs, out_sizes, ins, in_sizes, count, sizes, 1};
+        double time[3];
+
+        for (size_t i = 0, pos = 0; i < count; pos += out_sizes[i++])
+            outs[i] = &enc[pos];
+
+        //every input on one thread of its own
+        one.threads = 1;
+        one.pool = NULL;
+        one.split = 0;
+
+        double start_execution_time = timer();
+        manyStaticTask(&bench, 0);
+        time[0] = timer() - start_execution_time;
+
+        bench.width = threads;
+        start_execution_time = timer();
+        aransPoolRun(pool, threads, manyStaticTask, &bench);
+        time[1] = timer() - start_execution_time;
+
+        struct AransOptions steal = *options;
+        steal.pool = pool;
+
+        for (size_t i = 0; i < count; ++i)
+            outs[i] = &enc[total + (outs[i] - enc)];
+
+        start_execution_time = timer();
+        int failed = aransEncodeMany(&arans, &steal, outs, out_sizes, ins, in_sizes, count, &sizes[count]);
+        time[2] = timer() - start_execution_time;
+
+        for (size_t i = 0; i < count; ++i)
+            failed |= !sizes[i] || (sizes[i] != sizes[count + i]) || memcmp(outs[i], &enc[outs[i] - enc - total],
+                                                                            sizes[i]);
+
+        if (failed) {
+            printf("Streams differ!\n");
+        } else {
+            printf("%zu inputs from %zu to %zu bytes on %d threads\n", count, in_sizes[count - 1], in_sizes[0],
+                   threads);
+            printf("one thread %.3fs, static partition %.3fs (%.2fx), work stealing %.3fs (%.2fx)\n", time[0],
+                   time[1], time[0] / time[1], time[2], time[0] / time[2]);
+        }
+    }
+
+    if (pool)
+        aransPoolDestroy(pool);
+    free(in);
+    free(ins);
+    free(outs);
+    free(in_sizes);
+    free(out_sizes);
+    free(sizes);
+    free(enc);
+    return 0;
+}
+
+//decodes length bytes at offset of a compressed file without decoding the whole file
+static int decodeRange(const char *name, const char *out_name, uint64_t offset, size_t length, const char *dict) {
+    size_t in_size;
+    unsigned char *in = loadFile(name, &in_size);
+    if (!in)
+        return 0;
+
+    struct AransFrame frame;
+    unsigned char *out = (unsigned char *) malloc(length + 1);
+
+    struct Arans arans;
+    struct AransOptions options;
+    aransDefaultOptions(&options);
+
+    if (!out || !checkFrame(&frame, in, in_size) || !initModel(&arans, &options, dict)) {
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    if (frame.dict != options.dict) {
+        printf("Compressed with dictionary %08x!\n", (unsigned) frame.dict);
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    double start_execution_time = timer();
+    uint64_t start_clocks = __rdtsc();
+
+    size_t out_size = aransDecodeRange(&arans, options.dict, out, in, in_size, offset, length);
+
+    uint64_t clocks = __rdtsc() - start_clocks;
+    double execution_time = timer() - start_execution_time;
+
+    if (!out_size) {
+        printf("Range is out of the file or the file is damaged!\n");
+    } else {
+        FILE *out_file = fopen(out_name, "wb");
+        if (out_file) {
+            fwrite(out, out_size, 1, out_file);
+            fclose(out_file);
+        } else {
+            printf("Unable to write!\n");
+        }
+
+        printf("%zu bytes at %" PRIu64 " of %" PRIu64 "\n", out_size, offset, frame.size);
+        printf("%" PRIu64" clocks, %.3f ms\n", clocks, execution_time * 1000.0);
+    }
+
+    free(in);
+    free(out);
+    return 0;
+}
+
 //main function
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
+    struct AransOptions options;
+    const char *dict;
+
+    if ((argc == 3) && (strcmp(argv[1], "list") == 0))
+        return listChunks(argv[2]);
+
+    if ((argc >= 4) && (strcmp(argv[1], "append") == 0))
+        return parseOptions(&options, &dict, argc, argv, 4) ? appendFile(argv[2], argv[3], &options, dict) : 0;
+
+    if ((argc >= 4) && (strcmp(argv[1], "concat") == 0))
+        return concatFiles(argv[2], argc - 3, &argv[3]);
+
+    if ((argc >= 4) && (strcmp(argv[1], "train") == 0))
+        return trainDict(argv[2], argc - 3, &argv[3]);
+
+    if ((argc >= 6) && (strcmp(argv[1], "range") == 0))
+        return parseOptions(&options, &dict, argc, argv, 6) ?
+               decodeRange(argv[2], argv[3], strtoull(argv[4], NULL, 10), strtoull(argv[5], NULL, 10), dict) : 0;
+
+    if ((argc >= 4) && (strcmp(argv[1], "small") == 0))
+        return parseOptions(&options, &dict, argc, argv, 4) ?
+               benchMessages(argv[2], strtoull(argv[3], NULL, 10), &options, dict) : 0;
+
+    if ((argc >= 4) && (strcmp(argv[1], "jobs") == 0))
+        return parseOptions(&options, &dict, argc, argv, 4) ?
+               benchJobs(argv[2], strtoull(argv[3], NULL, 10), &options, dict) : 0;
+
+    if ((argc >= 3) && (strcmp(argv[1], "many") == 0))
+        return parseOptions(&options, &dict, argc, argv, 3) ? benchMany(argv[2], &options, dict) : 0;
+
+    if ((argc >= 3) && (strcmp(argv[1], "pair") == 0))
+        return parseOptions(&options, &dict, argc, argv, 3) ? benchPair(argv[2], &options, dict) : 0;
+
+    if ((argc >= 3) && (strcmp(argv[1], "bench") == 0))
+        return parseOptions(&options, &dict, argc, argv, 3) ? benchChecksums(argv[2], &options, dict) : 0;
+
+    if (argc < 4) {
         printf("Missing argument!\n");
         return 0;
     }
 
+    if (!parseOptions(&options, &dict, argc, argv, 4))
+        return 0;
+
     // 0 - mode arg is wrong, 1 - encoding, 2 - decoding
     uint8_t mode = 0;
 
@@ -52,67 +960,79 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    //the files are coded through the pipeline of arans_pipe.h, only blocks in flight are held in memory
     fseek(in_file, 0, SEEK_END);
-    size_t in_size = ftell(in_file);
+    uint64_t in_size = ftell(in_file);
     fseek(in_file, 0, SEEK_SET);
-    size_t out_size = 0;
-
-    unsigned char *in = (unsigned char *) malloc(in_size);
-    unsigned char *out = NULL;
-
-    if (!in) {
-        fclose(in_file);
-        fclose(out_file);
-        printf("Allocate failed!\n");
-        return 0;
-    }
-
-    size_t res = fread(in, in_size, 1, in_file);
+    uint64_t out_size = 0;
 
     double start_execution_time;
     uint64_t start_clocks;
     uint64_t clocks;
     double execution_time;
+    int failed;
 
     if (mode == 1) {
-        out_size = in_size + 128;
-        out = (unsigned char *) malloc(out_size);
-
         struct Arans arans;
-        aransInit(&arans);
+        if (!initModel(&arans, &options, dict)) {
+            fclose(in_file);
+            fclose(out_file);
+            return 0;
+        }
 
         start_execution_time = timer();
         start_clocks = __rdtsc();
 
         //do encoding
-        out_size = aransEncode(&arans, out, out_size, in, in_size);
+        failed = aransEncodeFile(&arans, &options, in_file, in_size, out_file, &out_size);
 
         clocks = __rdtsc() - start_clocks;
         execution_time = timer() - start_execution_time;
+
+        if (failed)
+            printf("Encoding failed!\n");
     }
 
     if (mode == 2) {
-        out_size = aransGetOutFileSize(in);
-        out = (unsigned char *) malloc(out_size);
+        unsigned char head[FRAME_MAX_SIZE];
+        size_t head_size = fread(head, 1, FRAME_MAX_SIZE, in_file);
+
+        struct AransFrame frame;
+        if (!checkFrame(&frame, head, head_size)) {
+            fclose(in_file);
+            fclose(out_file);
+            return 0;
+        }
 
         struct Arans arans;
-        aransInit(&arans);
+        if (!initModel(&arans, &options, dict)) {
+            fclose(in_file);
+            fclose(out_file);
+            return 0;
+        }
+
+        if (frame.dict != options.dict) {
+            printf("Compressed with dictionary %08x!\n", (unsigned) frame.dict);
+            fclose(in_file);
+            fclose(out_file);
+            return 0;
+        }
 
         start_execution_time = timer();
         start_clocks = __rdtsc();
 
         //do decoding
-        aransDecode(&arans, out, out_size, in, in_size);
+        failed = aransDecodeFile(&arans, &options, in_file, in_size, out_file, &out_size);
 
         clocks = __rdtsc() - start_clocks;
         execution_time = timer() - start_execution_time;
-    }
 
-    //write to output file
-    fwrite(out, out_size, 1, out_file);
+        if (failed)
+            printf("Decoding failed, the file is damaged!\n");
+    }
 
     //print decompression ratio
-    printf("%zu to %zu (%.1f%%)\n", in_size, out_size, 100.0 * (double) out_size / (double) in_size);
+    printf("%" PRIu64" to %" PRIu64" (%.1f%%)\n", in_size, out_size, 100.0 * (double) out_size / (double) in_size);
 
     printf("%" PRIu64" clocks, %.1f clocks/symbol (%5.1fMiB/s)\n", clocks,
            (double) clocks / (double) in_size,
@@ -120,7 +1040,7 @@ int main(int argc, char *argv[]) {
 
     if (mode == 1) {
         FILE *fstat = fopen("stat.txt", "a");
-        fprintf(fstat, "%zu\t%zu\n", in_size, out_size);
+        fprintf(fstat, "%" PRIu64"\t%" PRIu64"\n", in_size, out_size);
         fclose(fstat);
     }
 
@@ -128,10 +1048,6 @@ int main(int argc, char *argv[]) {
     fprintf(f_speed_stat, "%.1f\n", (double) clocks / (double) in_size);
     fclose(f_speed_stat);
 
-    //free buffers
-    free(in);
-    free(out);
-
     //close files
     fclose(in_file);
     fclose(out_file);